@@ -21,32 +21,66 @@
 
 #include <config.h>
 
+#include <errno.h>
 #include <locale.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <sys/timerfd.h>
 
 #include <glib.h>
 #include <glib/gi18n.h>
 #include <gio/gio.h>
+#include <gio/gunixfdlist.h>
+
+#include "logout-config.h"
 
 
 static gboolean opt_logout    = FALSE;
 static gboolean opt_poweroff  = FALSE;
 static gboolean opt_reboot    = FALSE;
+static gboolean opt_soft_reboot = FALSE;
 static gboolean opt_hibernate = FALSE;
 static gboolean opt_suspend   = FALSE;
+static gboolean opt_hybrid_sleep = FALSE;
+static gboolean opt_suspend_then_hibernate = FALSE;
+static gboolean opt_sleep     = FALSE;
+static gboolean opt_no_lock   = FALSE;
 static gint     opt_delay     = 0;
+static gchar   *opt_wake_at   = NULL;
+static gboolean opt_fast      = FALSE;
+static gint     opt_grace     = 0;
+static gint     opt_window    = 0;
+static gboolean opt_dry_run   = FALSE;
+static gboolean opt_query     = FALSE;
+static gboolean opt_json      = FALSE;
+static gboolean opt_watch     = FALSE;
+static gboolean opt_idle_policy = FALSE;
 
 static GOptionEntry options[] = 
 {
 	{ "logout",    'l', 0, G_OPTION_ARG_NONE, &opt_logout,    NULL, NULL },
 	{ "poweroff",  'p', 0, G_OPTION_ARG_NONE, &opt_poweroff,  NULL, NULL },
 	{ "reboot",    'r', 0, G_OPTION_ARG_NONE, &opt_reboot,    NULL, NULL },
+	{ "soft-reboot", 0, 0, G_OPTION_ARG_NONE, &opt_soft_reboot, NULL, NULL },
 	{ "hibernate", 'h', 0, G_OPTION_ARG_NONE, &opt_hibernate, NULL, NULL },
 	{ "suspend",   's', 0, G_OPTION_ARG_NONE, &opt_suspend,   NULL, NULL },
+	{ "hybrid-sleep", 0, 0, G_OPTION_ARG_NONE, &opt_hybrid_sleep, NULL, NULL },
+	{ "suspend-then-hibernate", 0, 0, G_OPTION_ARG_NONE, &opt_suspend_then_hibernate, NULL, NULL },
+	{ "sleep",     0,   0, G_OPTION_ARG_NONE, &opt_sleep,     NULL, NULL },
+	{ "no-lock",   0,   0, G_OPTION_ARG_NONE, &opt_no_lock,   NULL, NULL },
 	{ "delay",     'd', 0, G_OPTION_ARG_INT,  &opt_delay,     NULL, NULL },
+	{ "wake-at",   0,   0, G_OPTION_ARG_STRING, &opt_wake_at, NULL, NULL },
+	{ "fast",      'f', 0, G_OPTION_ARG_NONE, &opt_fast,      NULL, NULL },
+	{ "grace",     'g', 0, G_OPTION_ARG_INT,  &opt_grace,     NULL, NULL },
+	{ "window",    0,   0, G_OPTION_ARG_INT,  &opt_window,    NULL, NULL },
+	{ "dry-run",   'n', 0, G_OPTION_ARG_NONE, &opt_dry_run,   NULL, NULL },
+	{ "query",     'q', 0, G_OPTION_ARG_NONE, &opt_query,     NULL, NULL },
+	{ "json",      'j', 0, G_OPTION_ARG_NONE, &opt_json,      NULL, NULL },
+	{ "watch",     'w', 0, G_OPTION_ARG_NONE, &opt_watch,     NULL, NULL },
+	{ "idle-policy", 0, 0, G_OPTION_ARG_NONE, &opt_idle_policy, NULL, NULL },
 	{NULL}
 };
 
@@ -56,12 +90,104 @@ enum {
 	GSM_LOGOUT_MODE_FORCE
 };
 
+enum {
+	GSM_INHIBITOR_FLAG_LOGOUT = 1 << 0
+};
+
+/* default time given to session clients in fast logout mode */
+#define LOGOUT_GRACE_TIME 3000
+
+/* bound for each query made to gnome-session in fast logout mode */
+#define SM_QUERY_TIMEOUT 1000
+
+#ifndef CLOCK_REALTIME_ALARM
+#define CLOCK_REALTIME_ALARM 8
+#endif
+
+#define RTC_WAKEALARM "/sys/class/rtc/rtc0/wakealarm"
+
+/* how far from the requested time a wake up still counts as on time */
+#define WAKE_TOLERANCE 60
+
+/* must stay below logind's InhibitDelayMaxSec (5 seconds by default) */
+#define LOCK_TIMEOUT 4000
+
 typedef struct _Data {
     const char *function;
     const char *error_message;
+    gboolean    lock;
+    gint64      wake_time;
 } Data;
 
+typedef struct _WakeAlarm {
+	GMainLoop       *loop;
+	GDBusConnection *bus;
+	gint64           wake_time;
+	gint             fd;
+	gboolean         rtc;
+	gboolean         resumed;
+	guint            signal_id;
+} WakeAlarm;
+
+static const char *SCREENSAVER_INTERFACES[] = {
+	"org.gnome.ScreenSaver",
+	"org.freedesktop.ScreenSaver"
+};
+
+typedef struct _LockData {
+	GMainLoop       *loop;
+	GCancellable    *cancellable;
+	GDBusConnection *system_bus;
+	GDBusConnection *session_bus;
+	guint            locked_hint_id;
+	guint            active_changed_ids[2];
+	guint            timeout_id;
+	gint             fd;
+} LockData;
+
+static const char *CAPABILITIES[] = {
+	"CanPowerOff",
+	"CanReboot",
+	"CanSuspend",
+	"CanHibernate",
+	"CanHybridSleep",
+	"CanSuspendThenHibernate",
+	NULL
+};
+
+typedef struct _QueryData {
+	GDBusConnection *bus;
+	gchar           *values[G_N_ELEMENTS (CAPABILITIES)];
+	gchar           *printed;
+	guint            pending;
+	gboolean         dirty;
+} QueryData;
+
+typedef struct _FastLogout {
+	GMainLoop  *loop;
+	GDBusProxy *proxy;
+	GHashTable *clients;
+	gint64      start;
+	gint        grace;
+	guint       removed_id;
+	guint       timeout_id;
+	gulong      closed_id;
+} FastLogout;
+
+typedef struct _IdlePolicy {
+	GDBusConnection *bus;
+	gchar           *session_path;
+	gchar           *action;
+	gint             timeout;
+	gint             battery_timeout;
+	guint            timeout_id;
+	guint64          idle_since;
+	guint64          acted_since;
+} IdlePolicy;
+
 static GMainLoop *loop = NULL;
+static QueryData  query;
+static IdlePolicy policy;
 
 
 
@@ -85,59 +211,1018 @@ sm_proxy_get (void)
                                            NULL,
                                            NULL);
 
-	return proxy;
+	return proxy;
+}
+
+static GDBusProxy *
+login1_proxy_get (void)
+{
+	GDBusProxy *proxy;
+
+	proxy = g_dbus_proxy_new_for_bus_sync (G_BUS_TYPE_SYSTEM,
+                                           G_DBUS_PROXY_FLAGS_NONE,
+                                           NULL, 
+                                           "org.freedesktop.login1",
+                                           "/org/freedesktop/login1",
+                                           "org.freedesktop.login1.Manager",
+                                           NULL,
+                                           NULL);
+
+    
+	return proxy;
+}
+
+/* Object path of our login session, NULL when there is none.
+ * GetSessionByPID() fails when we run outside the session scope, e.g. in
+ * an app-*.scope of systemd --user, so go by XDG_SESSION_ID, else by
+ * logind's "auto" session: the caller's one, else the user's display
+ * session. The real path is returned, signals are not sent on "auto". */
+static gchar *
+login1_session_path_get (GDBusConnection *bus)
+{
+	gchar    *id, *path = NULL;
+	GVariant *reply, *value;
+
+	id = g_strdup (g_getenv ("XDG_SESSION_ID"));
+	if (id == NULL || *id == '\0') {
+		g_free (id);
+		id = NULL;
+
+		reply = g_dbus_connection_call_sync (bus,
+                                             "org.freedesktop.login1",
+                                             "/org/freedesktop/login1/session/auto",
+                                             "org.freedesktop.DBus.Properties",
+                                             "Get",
+                                             g_variant_new ("(ss)",
+                                                            "org.freedesktop.login1.Session",
+                                                            "Id"),
+                                             G_VARIANT_TYPE ("(v)"),
+                                             G_DBUS_CALL_FLAGS_NONE,
+                                             -1, NULL, NULL);
+		if (reply == NULL)
+			return NULL;
+
+		g_variant_get (reply, "(v)", &value);
+		if (g_variant_is_of_type (value, G_VARIANT_TYPE_STRING))
+			id = g_variant_dup_string (value, NULL);
+		g_variant_unref (value);
+		g_variant_unref (reply);
+
+		if (id == NULL)
+			return NULL;
+	}
+
+	reply = g_dbus_connection_call_sync (bus,
+                                         "org.freedesktop.login1",
+                                         "/org/freedesktop/login1",
+                                         "org.freedesktop.login1.Manager",
+                                         "GetSession",
+                                         g_variant_new ("(s)", id),
+                                         G_VARIANT_TYPE ("(o)"),
+                                         G_DBUS_CALL_FLAGS_NONE,
+                                         -1, NULL, NULL);
+	if (reply) {
+		g_variant_get (reply, "(o)", &path);
+		g_variant_unref (reply);
+	}
+
+	g_free (id);
+
+	return path;
+}
+
+/* Take a logind "delay" inhibitor for sleep, so that logind holds back
+ * the suspend until the screen is locked (or the inhibitor is released) */
+static gint
+sleep_inhibitor_take (GDBusProxy *proxy)
+{
+	gint         fd, index;
+	GVariant    *reply;
+	GError      *error;
+	GUnixFDList *fd_list = NULL;
+
+	error = NULL;
+	reply = g_dbus_proxy_call_with_unix_fd_list_sync (proxy,
+                                    "Inhibit",
+                                    g_variant_new ("(ssss)",
+                                                   "sleep",
+                                                   "gooroom-logout",
+                                                   "Locking the screen before sleep",
+                                                   "delay"),
+                                    G_DBUS_CALL_FLAGS_NONE,
+                                    -1, NULL, &fd_list, NULL, &error);
+
+	if (error != NULL) {
+		g_warning ("Failed to take sleep inhibitor: %s", error->message);
+		g_error_free (error);
+		return -1;
+	}
+
+	g_variant_get (reply, "(h)", &index);
+	fd = g_unix_fd_list_get (fd_list, index, NULL);
+
+	g_variant_unref (reply);
+	g_object_unref (fd_list);
+
+	return fd;
+}
+
+static void
+screen_lock_release (LockData *lock)
+{
+	if (lock->fd >= 0) {
+		close (lock->fd);
+		lock->fd = -1;
+	}
+
+	g_main_loop_quit (lock->loop);
+}
+
+static gboolean
+on_screen_lock_timeout (gpointer user_data)
+{
+	LockData *lock = (LockData *)user_data;
+
+	g_warning ("Screen locker did not become active in time");
+
+	lock->timeout_id = 0;
+	screen_lock_release (lock);
+
+	return FALSE;
+}
+
+static void
+on_session_properties_changed (GDBusConnection *connection,
+                               const gchar     *sender_name,
+                               const gchar     *object_path,
+                               const gchar     *interface_name,
+                               const gchar     *signal_name,
+                               GVariant        *parameters,
+                               gpointer         user_data)
+{
+	gboolean  locked = FALSE;
+	GVariant *changed;
+
+	changed = g_variant_get_child_value (parameters, 1);
+	if (g_variant_lookup (changed, "LockedHint", "b", &locked) && locked)
+		screen_lock_release ((LockData *)user_data);
+
+	g_variant_unref (changed);
+}
+
+static void
+on_screensaver_active_changed (GDBusConnection *connection,
+                               const gchar     *sender_name,
+                               const gchar     *object_path,
+                               const gchar     *interface_name,
+                               const gchar     *signal_name,
+                               GVariant        *parameters,
+                               gpointer         user_data)
+{
+	gboolean active = FALSE;
+
+	if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(b)")))
+		return;
+
+	g_variant_get (parameters, "(b)", &active);
+	if (active)
+		screen_lock_release ((LockData *)user_data);
+}
+
+static void
+on_session_lock_finished (GObject      *source,
+                          GAsyncResult *result,
+                          gpointer      user_data)
+{
+	GVariant *reply;
+	GError   *error = NULL;
+
+	reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, &error);
+	if (error != NULL) {
+		if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+			g_warning ("Failed to lock the screen: %s", error->message);
+			/* nobody is going to lock, don't hold the sleep back */
+			screen_lock_release ((LockData *)user_data);
+		}
+		g_error_free (error);
+		return;
+	}
+
+	g_variant_unref (reply);
+}
+
+static gboolean
+session_locked_hint_get (GDBusConnection *system_bus, const gchar *session_path)
+{
+	gboolean  locked = FALSE;
+	GVariant *reply, *value;
+
+	reply = g_dbus_connection_call_sync (system_bus,
+                                         "org.freedesktop.login1",
+                                         session_path,
+                                         "org.freedesktop.DBus.Properties",
+                                         "Get",
+                                         g_variant_new ("(ss)",
+                                                        "org.freedesktop.login1.Session",
+                                                        "LockedHint"),
+                                         G_VARIANT_TYPE ("(v)"),
+                                         G_DBUS_CALL_FLAGS_NONE,
+                                         -1, NULL, NULL);
+	if (reply) {
+		g_variant_get (reply, "(v)", &value);
+		if (g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN))
+			locked = g_variant_get_boolean (value);
+		g_variant_unref (value);
+		g_variant_unref (reply);
+	}
+
+	return locked;
+}
+
+/* Ask the session's locker to lock without waiting for it. Whichever
+ * reports first, LockedHint on the logind session or ActiveChanged from
+ * the screensaver, releases the sleep inhibitor @fd */
+static LockData *
+screen_lock_start (GDBusConnection *system_bus, gint fd)
+{
+	guint     i;
+	LockData *lock;
+	gchar    *session_path;
+
+	lock = g_new0 (LockData, 1);
+	lock->fd = fd;
+	lock->loop = g_main_loop_new (NULL, FALSE);
+	lock->cancellable = g_cancellable_new ();
+	lock->system_bus = g_object_ref (system_bus);
+	lock->session_bus = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, NULL);
+
+	/* only the screensaver interfaces, any other ActiveChanged signal
+	 * must not release the inhibitor before the lock */
+	for (i = 0; lock->session_bus && i < G_N_ELEMENTS (SCREENSAVER_INTERFACES); i++) {
+		lock->active_changed_ids[i] =
+			g_dbus_connection_signal_subscribe (lock->session_bus,
+                                                NULL,
+                                                SCREENSAVER_INTERFACES[i],
+                                                "ActiveChanged",
+                                                NULL,
+                                                NULL,
+                                                G_DBUS_SIGNAL_FLAGS_NONE,
+                                                on_screensaver_active_changed,
+                                                lock, NULL);
+	}
+
+	session_path = login1_session_path_get (system_bus);
+	if (session_path == NULL) {
+		g_warning ("Failed to find the session to lock");
+		screen_lock_release (lock);
+		return lock;
+	}
+
+	if (session_locked_hint_get (system_bus, session_path)) {
+		screen_lock_release (lock);
+		g_free (session_path);
+		return lock;
+	}
+
+	lock->locked_hint_id =
+		g_dbus_connection_signal_subscribe (system_bus,
+                                            "org.freedesktop.login1",
+                                            "org.freedesktop.DBus.Properties",
+                                            "PropertiesChanged",
+                                            session_path,
+                                            "org.freedesktop.login1.Session",
+                                            G_DBUS_SIGNAL_FLAGS_NONE,
+                                            on_session_properties_changed,
+                                            lock, NULL);
+
+	g_dbus_connection_call (system_bus,
+                            "org.freedesktop.login1",
+                            session_path,
+                            "org.freedesktop.login1.Session",
+                            "Lock",
+                            NULL, NULL,
+                            G_DBUS_CALL_FLAGS_NONE,
+                            -1, lock->cancellable,
+                            on_session_lock_finished,
+                            lock);
+
+	g_free (session_path);
+
+	return lock;
+}
+
+/* Wait for the locker (at most LOCK_TIMEOUT) if @wait is TRUE, then drop
+ * the sleep inhibitor */
+static void
+screen_lock_finish (LockData *lock, gboolean wait)
+{
+	guint i;
+
+	if (wait && lock->fd >= 0) {
+		lock->timeout_id = g_timeout_add (LOCK_TIMEOUT, on_screen_lock_timeout, lock);
+		g_main_loop_run (lock->loop);
+	}
+
+	g_cancellable_cancel (lock->cancellable);
+
+	if (lock->timeout_id > 0)
+		g_source_remove (lock->timeout_id);
+	if (lock->locked_hint_id > 0)
+		g_dbus_connection_signal_unsubscribe (lock->system_bus, lock->locked_hint_id);
+	for (i = 0; i < G_N_ELEMENTS (lock->active_changed_ids); i++) {
+		if (lock->active_changed_ids[i] > 0)
+			g_dbus_connection_signal_unsubscribe (lock->session_bus, lock->active_changed_ids[i]);
+	}
+	if (lock->fd >= 0)
+		close (lock->fd);
+
+	g_clear_object (&lock->cancellable);
+	g_clear_object (&lock->system_bus);
+	g_clear_object (&lock->session_bus);
+	g_main_loop_unref (lock->loop);
+	g_free (lock);
+}
+
+static gboolean
+is_function_available (GDBusProxy *proxy, const char *function)
+{
+	gboolean  result = FALSE;
+	gchar    *method;
+	GVariant *r;
+
+	method = g_strdup_printf ("Can%s", function);
+	r = g_dbus_proxy_call_sync (proxy,
+                                method,
+                                NULL,
+                                G_DBUS_CALL_FLAGS_NONE,
+                                -1, NULL, NULL);
+	g_free (method);
+
+	if (r) {
+		if (g_variant_is_of_type (r, G_VARIANT_TYPE ("(s)"))) {
+			const gchar *string = NULL;
+			g_variant_get (r, "(&s)", &string);
+			result = g_str_equal (string, "yes");
+		}
+		g_variant_unref (r);
+	}
+
+	return result;
+}
+
+/* The sleep action run by --sleep is chosen by site policy, falling
+ * back to plain suspend when the policy action is not available */
+static const char *
+sleep_function_get (void)
+{
+	gchar      *action;
+	const char *function = "Suspend";
+	GDBusProxy *proxy;
+
+	action = logout_config_get_string ("Sleep", "DefaultAction", "suspend");
+
+	if (g_str_equal (action, "hibernate"))
+		function = "Hibernate";
+	else if (g_str_equal (action, "hybrid-sleep"))
+		function = "HybridSleep";
+	else if (g_str_equal (action, "suspend-then-hibernate"))
+		function = "SuspendThenHibernate";
+	else if (!g_str_equal (action, "suspend"))
+		g_warning ("Unknown sleep action '%s' in %s", action, LOGOUT_CONFIG_FILE);
+
+	g_free (action);
+
+	if (g_str_equal (function, "Suspend"))
+		return function;
+
+	proxy = login1_proxy_get ();
+	if (proxy == NULL || !is_function_available (proxy, function))
+		function = "Suspend";
+	g_clear_object (&proxy);
+
+	return function;
+}
+
+static gchar *
+sm_object_get_string (GDBusConnection *bus,
+                      const gchar     *object_path,
+                      const gchar     *interface_name,
+                      const gchar     *method)
+{
+	gchar    *value = NULL;
+	GVariant *reply;
+
+	reply = g_dbus_connection_call_sync (bus,
+                                         "org.gnome.SessionManager",
+                                         object_path,
+                                         interface_name,
+                                         method,
+                                         NULL,
+                                         G_VARIANT_TYPE ("(s)"),
+                                         G_DBUS_CALL_FLAGS_NONE,
+                                         SM_QUERY_TIMEOUT, NULL, NULL);
+	if (reply) {
+		g_variant_get (reply, "(s)", &value);
+		g_variant_unref (reply);
+	}
+
+	return value;
+}
+
+static void
+sm_inhibitors_log (GDBusProxy *proxy)
+{
+	GVariant        *reply, *flags;
+	GVariantIter    *iter;
+	GDBusConnection *bus;
+	const gchar     *path;
+
+	reply = g_dbus_proxy_call_sync (proxy,
+                                    "GetInhibitors",
+                                    NULL,
+                                    G_DBUS_CALL_FLAGS_NONE,
+                                    SM_QUERY_TIMEOUT, NULL, NULL);
+	if (reply == NULL)
+		return;
+
+	bus = g_dbus_proxy_get_connection (proxy);
+
+	g_variant_get (reply, "(ao)", &iter);
+	while (g_variant_iter_loop (iter, "&o", &path)) {
+		gchar *app_id, *reason;
+
+		flags = g_dbus_connection_call_sync (bus,
+                                             "org.gnome.SessionManager",
+                                             path,
+                                             "org.gnome.SessionManager.Inhibitor",
+                                             "GetFlags",
+                                             NULL,
+                                             G_VARIANT_TYPE ("(u)"),
+                                             G_DBUS_CALL_FLAGS_NONE,
+                                             SM_QUERY_TIMEOUT, NULL, NULL);
+		if (flags) {
+			guint32 value;
+
+			g_variant_get (flags, "(u)", &value);
+			g_variant_unref (flags);
+
+			if (!(value & GSM_INHIBITOR_FLAG_LOGOUT))
+				continue;
+		}
+
+		app_id = sm_object_get_string (bus, path, "org.gnome.SessionManager.Inhibitor", "GetAppId");
+		reason = sm_object_get_string (bus, path, "org.gnome.SessionManager.Inhibitor", "GetReason");
+
+		g_message ("Logout is inhibited by %s: %s",
+                   app_id ? app_id : path, reason ? reason : "");
+
+		g_free (app_id);
+		g_free (reason);
+	}
+
+	g_variant_iter_free (iter);
+	g_variant_unref (reply);
+}
+
+static GHashTable *
+sm_clients_get (GDBusProxy *proxy)
+{
+	GVariant        *reply;
+	GVariantIter    *iter;
+	GHashTable      *clients;
+	GDBusConnection *bus;
+	const gchar     *path;
+
+	clients = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+	reply = g_dbus_proxy_call_sync (proxy,
+                                    "GetClients",
+                                    NULL,
+                                    G_DBUS_CALL_FLAGS_NONE,
+                                    SM_QUERY_TIMEOUT, NULL, NULL);
+	if (reply == NULL)
+		return clients;
+
+	bus = g_dbus_proxy_get_connection (proxy);
+
+	g_variant_get (reply, "(ao)", &iter);
+	while (g_variant_iter_loop (iter, "&o", &path)) {
+		gchar *app_id;
+
+		app_id = sm_object_get_string (bus, path, "org.gnome.SessionManager.Client", "GetAppId");
+		if (app_id == NULL || *app_id == '\0') {
+			g_free (app_id);
+			app_id = g_strdup (path);
+		}
+
+		g_hash_table_insert (clients, g_strdup (path), app_id);
+	}
+
+	g_variant_iter_free (iter);
+	g_variant_unref (reply);
+
+	return clients;
+}
+
+static void
+on_sm_client_removed (GDBusConnection *connection,
+                      const gchar     *sender_name,
+                      const gchar     *object_path,
+                      const gchar     *interface_name,
+                      const gchar     *signal_name,
+                      GVariant        *parameters,
+                      gpointer         user_data)
+{
+	FastLogout  *fast = (FastLogout *)user_data;
+	const gchar *path, *app_id;
+
+	g_variant_get (parameters, "(&o)", &path);
+
+	app_id = g_hash_table_lookup (fast->clients, path);
+	if (app_id == NULL)
+		return;
+
+	g_message ("%s ended %" G_GINT64_FORMAT " ms after logout request",
+               app_id, (g_get_monotonic_time () - fast->start) / 1000);
+
+	g_hash_table_remove (fast->clients, path);
+
+	if (g_hash_table_size (fast->clients) == 0)
+		g_main_loop_quit (fast->loop);
+}
+
+static void
+on_sm_connection_closed (GDBusConnection *connection,
+                         gboolean         remote_peer_vanished,
+                         GError          *error,
+                         gpointer         user_data)
+{
+	FastLogout *fast = (FastLogout *)user_data;
+
+	g_main_loop_quit (fast->loop);
+}
+
+/* gnome-session takes Logout only while running, so once it is ending
+ * the session a busy client or its "applications are busy" dialog can
+ * only be cut short from outside: let logind terminate the session */
+static gboolean
+on_fast_logout_timeout (gpointer user_data)
+{
+	GHashTableIter   iter;
+	gpointer         app_id;
+	gchar           *session_path;
+	GDBusConnection *bus;
+	GVariant        *reply;
+	GError          *error = NULL;
+	FastLogout      *fast = (FastLogout *)user_data;
+
+	fast->timeout_id = 0;
+
+	g_hash_table_iter_init (&iter, fast->clients);
+	while (g_hash_table_iter_next (&iter, NULL, &app_id))
+		g_message ("%s delayed logout for more than %d ms", (const gchar *)app_id, fast->grace);
+
+	bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
+	if (error != NULL) {
+		g_warning ("Failed to connect to the system bus: %s", error->message);
+		g_error_free (error);
+		goto done;
+	}
+
+	session_path = login1_session_path_get (bus);
+	if (session_path == NULL) {
+		g_warning ("Failed to find the session to terminate");
+		g_object_unref (bus);
+		goto done;
+	}
+
+	g_message ("Terminating the session after %d ms grace time", fast->grace);
+
+	reply = g_dbus_connection_call_sync (bus,
+                                         "org.freedesktop.login1",
+                                         session_path,
+                                         "org.freedesktop.login1.Session",
+                                         "Terminate",
+                                         NULL,
+                                         NULL,
+                                         G_DBUS_CALL_FLAGS_NONE,
+                                         -1, NULL, &error);
+
+	if (error != NULL) {
+		g_warning ("Failed to terminate the session: %s", error->message);
+		g_error_free (error);
+	} else {
+		g_variant_unref (reply);
+	}
+
+	g_free (session_path);
+	g_object_unref (bus);
+
+done:
+	g_main_loop_quit (fast->loop);
+
+	return FALSE;
+}
+
+/* Fast logout: note who could hold the logout back before asking for it,
+ * so that slow clients can be reported and the session terminated after
+ * the grace time */
+static FastLogout *
+fast_logout_start (GDBusProxy *proxy, gint grace)
+{
+	FastLogout *fast;
+
+	fast = g_new0 (FastLogout, 1);
+	fast->loop = g_main_loop_new (NULL, FALSE);
+	fast->proxy = g_object_ref (proxy);
+	fast->grace = grace;
+
+	sm_inhibitors_log (proxy);
+	fast->clients = sm_clients_get (proxy);
+
+	fast->removed_id =
+		g_dbus_connection_signal_subscribe (g_dbus_proxy_get_connection (proxy),
+                                            "org.gnome.SessionManager",
+                                            "org.gnome.SessionManager",
+                                            "ClientRemoved",
+                                            "/org/gnome/SessionManager",
+                                            NULL,
+                                            G_DBUS_SIGNAL_FLAGS_NONE,
+                                            on_sm_client_removed,
+                                            fast, NULL);
+
+	fast->closed_id = g_signal_connect (g_dbus_proxy_get_connection (proxy), "closed",
+                                        G_CALLBACK (on_sm_connection_closed), fast);
+
+	fast->start = g_get_monotonic_time ();
+
+	return fast;
+}
+
+static void
+fast_logout_finish (FastLogout *fast, gboolean wait)
+{
+	GDBusConnection *bus = g_dbus_proxy_get_connection (fast->proxy);
+
+	if (wait && g_hash_table_size (fast->clients) > 0) {
+		fast->timeout_id = g_timeout_add (fast->grace, on_fast_logout_timeout, fast);
+		g_main_loop_run (fast->loop);
+	}
+
+	if (fast->timeout_id > 0)
+		g_source_remove (fast->timeout_id);
+
+	g_dbus_connection_signal_unsubscribe (bus, fast->removed_id);
+	g_signal_handler_disconnect (bus, fast->closed_id);
+
+	g_hash_table_destroy (fast->clients);
+	g_clear_object (&fast->proxy);
+	g_main_loop_unref (fast->loop);
+	g_free (fast);
+}
+
+static gboolean
+do_logout_idle (gpointer user_data)
+{
+	GVariant   *reply;
+	GError     *error;
+	GDBusProxy *proxy;
+	FastLogout *fast = NULL;
+
+	proxy = sm_proxy_get ();
+	if (proxy == NULL)
+		goto done;
+
+	if (opt_fast || logout_config_get_boolean ("Logout", "Fast", FALSE)) {
+		gint grace = opt_grace > 0
+			? opt_grace
+			: logout_config_get_integer ("Logout", "GraceTime", LOGOUT_GRACE_TIME);
+
+		fast = fast_logout_start (proxy, grace);
+	}
+
+	error = NULL;
+	reply = g_dbus_proxy_call_sync (proxy,
+                                    "Logout",
+                                    g_variant_new ("(u)", GSM_LOGOUT_MODE_NO_CONFIRMATION),
+                                    G_DBUS_CALL_FLAGS_NONE,
+                                    -1, NULL, &error);
+
+	if (error != NULL) {
+		g_warning ("Failed to call logout: %s", error->message);
+		g_error_free (error);
+	} else {
+		g_variant_unref (reply);
+	}
+
+	if (fast)
+		fast_logout_finish (fast, reply != NULL);
+
+	g_clear_object (&proxy);
+
+done:
+	if (loop)
+		g_main_loop_quit (loop);
+
+	return FALSE;
+}
+
+/* RebootWithFlags() flags of logind, see sd-login */
+#define SD_LOGIND_REBOOT_VIA_KEXEC (G_GUINT64_CONSTANT (1) << 1)
+#define SD_LOGIND_SOFT_REBOOT      (G_GUINT64_CONSTANT (1) << 2)
+
+static gboolean
+kexec_kernel_loaded (void)
+{
+	gchar    *contents = NULL;
+	gboolean  loaded = FALSE;
+
+	if (g_file_get_contents ("/sys/kernel/kexec_loaded", &contents, NULL, NULL))
+		loaded = g_str_has_prefix (contents, "1");
+	g_free (contents);
+
+	return loaded;
+}
+
+/* Goes through logind like the plain reboot, so that the same polkit
+ * action and the block inhibitors apply */
+static gboolean
+login1_reboot_with_flags (GDBusProxy *proxy, guint64 flags, GError **error)
+{
+	GVariant *reply;
+
+	reply = g_dbus_proxy_call_sync (proxy,
+                                    "RebootWithFlags",
+                                    g_variant_new ("(t)", flags),
+                                    G_DBUS_CALL_FLAGS_ALLOW_INTERACTIVE_AUTHORIZATION,
+                                    -1, NULL, error);
+	if (reply == NULL)
+		return FALSE;
+
+	g_variant_unref (reply);
+
+	return TRUE;
+}
+
+/* logind without RebootWithFlags() or without the given flag */
+static gboolean
+login1_flag_unsupported (const GError *error)
+{
+	return g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD) ||
+           g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS);
+}
+
+/* Restart only the userspace through a soft reboot of logind, else
+ * through kexec when site policy allows it and a kernel is loaded, else
+ * do a full reboot. Only a logind that does not know the flag leads to
+ * the next step, any other refusal ends the request. */
+static gboolean
+do_soft_reboot_idle (gpointer user_data)
+{
+	const gchar *path = NULL;
+	gint64       start;
+	GError      *error = NULL;
+	GDBusProxy  *proxy;
+	GVariant    *reply;
+
+	start = g_get_monotonic_time ();
+
+	proxy = login1_proxy_get ();
+	if (proxy == NULL)
+		goto done;
+
+	if (login1_reboot_with_flags (proxy, SD_LOGIND_SOFT_REBOOT, &error)) {
+		path = "soft-reboot";
+		goto report;
+	}
+
+	if (!login1_flag_unsupported (error)) {
+		g_warning ("Failed to call soft reboot: %s", error->message);
+		g_error_free (error);
+		goto report;
+	}
+
+	g_message ("Soft reboot is not supported by logind: %s", error->message);
+	g_clear_error (&error);
+
+	if (logout_config_get_boolean ("Restart", "KexecFallback", FALSE) && kexec_kernel_loaded ()) {
+		if (login1_reboot_with_flags (proxy, SD_LOGIND_REBOOT_VIA_KEXEC, &error)) {
+			path = "kexec";
+			goto report;
+		}
+
+		if (!login1_flag_unsupported (error)) {
+			g_warning ("Failed to call kexec reboot: %s", error->message);
+			g_error_free (error);
+			goto report;
+		}
+
+		g_message ("Kexec reboot is not supported by logind: %s", error->message);
+		g_clear_error (&error);
+	}
+
+	reply = g_dbus_proxy_call_sync (proxy,
+                                    "Reboot",
+                                    g_variant_new ("(b)", TRUE),
+                                    G_DBUS_CALL_FLAGS_NONE,
+                                    -1, NULL, &error);
+	if (error != NULL) {
+		g_warning ("Failed to call reboot: %s", error->message);
+		g_error_free (error);
+	} else {
+		path = "reboot";
+		g_variant_unref (reply);
+	}
+
+report:
+	if (path)
+		g_message ("Restarting through %s, requested in %" G_GINT64_FORMAT " ms",
+                   path, (g_get_monotonic_time () - start) / 1000);
+
+	g_clear_object (&proxy);
+
+done:
+	if (loop)
+		g_main_loop_quit (loop);
+
+	return FALSE;
+}
+
+/* "HH:MM[:SS]" is the next such local time, "@SECONDS" a UNIX time,
+ * returns -1 when @string is neither */
+static gint64
+wake_time_parse (const gchar *string)
+{
+	gint       hour, minute, second = 0, consumed = 0;
+	gint64     wake_time;
+	gchar     *end = NULL;
+	GDateTime *now, *when, *tomorrow;
+
+	if (string[0] == '@') {
+		wake_time = g_ascii_strtoll (string + 1, &end, 10);
+		return (end != string + 1 && *end == '\0' && wake_time > 0) ? wake_time : -1;
+	}
+
+	/* the whole string has to be a time, "7:30pm" is not 07:30 */
+	if (sscanf (string, "%d:%d:%d%n", &hour, &minute, &second, &consumed) < 3 ||
+        string[consumed] != '\0') {
+		second = 0;
+		consumed = 0;
+		if (sscanf (string, "%d:%d%n", &hour, &minute, &consumed) < 2 ||
+            string[consumed] != '\0')
+			return -1;
+	}
+
+	if (hour < 0 || hour > 23 || minute < 0 || minute > 59 || second < 0 || second > 59)
+		return -1;
+
+	now = g_date_time_new_now_local ();
+	when = g_date_time_new_local (g_date_time_get_year (now),
+                                  g_date_time_get_month (now),
+                                  g_date_time_get_day_of_month (now),
+                                  hour, minute, second);
+
+	/* a local time skipped by a DST change */
+	if (when == NULL) {
+		g_date_time_unref (now);
+		return -1;
+	}
+
+	if (g_date_time_compare (when, now) <= 0) {
+		tomorrow = g_date_time_add_days (when, 1);
+		g_date_time_unref (when);
+		when = tomorrow;
+	}
+
+	wake_time = g_date_time_to_unix (when);
+
+	g_date_time_unref (when);
+	g_date_time_unref (now);
+
+	return wake_time;
+}
+
+static gboolean
+rtc_wakealarm_write (gint64 value)
+{
+	FILE     *file;
+	gboolean  ret;
+
+	file = fopen (RTC_WAKEALARM, "w");
+	if (file == NULL)
+		return FALSE;
+
+	ret = fprintf (file, "%" G_GINT64_FORMAT "\n", value) > 0;
+
+	return (fclose (file) == 0) && ret;
+}
+
+static void
+on_prepare_for_sleep (GDBusConnection *connection,
+                      const gchar     *sender_name,
+                      const gchar     *object_path,
+                      const gchar     *interface_name,
+                      const gchar     *signal_name,
+                      GVariant        *parameters,
+                      gpointer         user_data)
+{
+	gboolean   start = TRUE;
+	WakeAlarm *wake = (WakeAlarm *)user_data;
+
+	g_variant_get (parameters, "(b)", &start);
+	if (start)
+		return;
+
+	wake->resumed = TRUE;
+	g_main_loop_quit (wake->loop);
 }
 
-static GDBusProxy *
-login1_proxy_get (void)
+/* Arm the wake up before sleeping: an alarm timer wakes the system from
+ * suspend when we have CAP_WAKE_ALARM, else program the RTC directly.
+ * The alarm timer does not survive hibernation, @rtc_only asks for the
+ * RTC for the actions that end up hibernated. */
+static WakeAlarm *
+wake_alarm_arm (GDBusConnection *bus, gint64 wake_time, gboolean rtc_only)
 {
-	GDBusProxy *proxy;
+	WakeAlarm         *wake;
+	struct itimerspec  spec = { { 0, 0 }, { 0, 0 } };
 
-	proxy = g_dbus_proxy_new_for_bus_sync (G_BUS_TYPE_SYSTEM,
-                                           G_DBUS_PROXY_FLAGS_NONE,
-                                           NULL, 
-                                           "org.freedesktop.login1",
-                                           "/org/freedesktop/login1",
-                                           "org.freedesktop.login1.Manager",
-                                           NULL,
-                                           NULL);
+	/* --delay or --window may have taken us past the wake up time */
+	if (wake_time <= g_get_real_time () / G_USEC_PER_SEC) {
+		g_warning ("The wake up time has passed, not going to sleep");
+		return NULL;
+	}
 
-    
-	return proxy;
+	wake = g_new0 (WakeAlarm, 1);
+	wake->wake_time = wake_time;
+	wake->fd = -1;
+
+	spec.it_value.tv_sec = wake_time;
+
+	if (!rtc_only)
+		wake->fd = timerfd_create (CLOCK_REALTIME_ALARM, TFD_CLOEXEC);
+	if (wake->fd >= 0 && timerfd_settime (wake->fd, TFD_TIMER_ABSTIME, &spec, NULL) != 0) {
+		close (wake->fd);
+		wake->fd = -1;
+	}
+
+	if (wake->fd < 0) {
+		/* the RTC refuses a new alarm while one is set */
+		if (!rtc_wakealarm_write (0) || !rtc_wakealarm_write (wake_time)) {
+			g_warning ("Failed to arm the wake up: %s", g_strerror (errno));
+			g_free (wake);
+			return NULL;
+		}
+		wake->rtc = TRUE;
+	}
+
+	wake->loop = g_main_loop_new (NULL, FALSE);
+	wake->bus = g_object_ref (bus);
+	wake->signal_id =
+		g_dbus_connection_signal_subscribe (bus,
+                                            "org.freedesktop.login1",
+                                            "org.freedesktop.login1.Manager",
+                                            "PrepareForSleep",
+                                            "/org/freedesktop/login1",
+                                            NULL,
+                                            G_DBUS_SIGNAL_FLAGS_NONE,
+                                            on_prepare_for_sleep,
+                                            wake, NULL);
+
+	return wake;
 }
 
-static gboolean
-do_logout_idle (gpointer user_data)
+/* Wait for the resume if @wait is TRUE and tell whether the wake up came
+ * when it was asked for, then disarm */
+static void
+wake_alarm_finish (WakeAlarm *wake, gboolean wait)
 {
-	GVariant   *reply;
-	GError     *error;
-	GDBusProxy *proxy;
+	gint64 delta;
 
-	proxy = sm_proxy_get ();
-	if (proxy == NULL)
-		goto done;
+	if (wait) {
+		if (!wake->resumed)
+			g_main_loop_run (wake->loop);
 
-	error = NULL;
-	reply = g_dbus_proxy_call_sync (proxy,
-                                    "Logout",
-                                    g_variant_new ("(u)", GSM_LOGOUT_MODE_NO_CONFIRMATION),
-                                    G_DBUS_CALL_FLAGS_NONE,
-                                    -1, NULL, &error);
+		delta = g_get_real_time () / G_USEC_PER_SEC - wake->wake_time;
 
-	if (error != NULL) {
-		g_warning ("Failed to call logout: %s", error->message);
-		g_error_free (error);
-	} else {
-		g_variant_unref (reply);
+		if (delta < -WAKE_TOLERANCE)
+			g_message ("Resumed %" G_GINT64_FORMAT " s before the scheduled wake up", -delta);
+		else if (delta > WAKE_TOLERANCE)
+			g_message ("Resumed %" G_GINT64_FORMAT " s after the scheduled wake up", delta);
+		else
+			g_message ("Resumed on time for the scheduled wake up (%+" G_GINT64_FORMAT " s)", delta);
 	}
 
-	g_clear_object (&proxy);
+	g_dbus_connection_signal_unsubscribe (wake->bus, wake->signal_id);
 
-done:
-	if (loop)
-		g_main_loop_quit (loop);
+	if (wake->fd >= 0)
+		close (wake->fd);
+	else if (wake->rtc)
+		rtc_wakealarm_write (0);
 
-	return FALSE;
+	g_clear_object (&wake->bus);
+	g_main_loop_unref (wake->loop);
+	g_free (wake);
 }
 
 static gboolean
@@ -146,6 +1231,9 @@ do_endsession_idle (gpointer user_data)
 	GVariant   *reply;
 	GError     *error;
     GDBusProxy *proxy;
+	LockData   *lock = NULL;
+	WakeAlarm  *wake = NULL;
+	gint        inhibit_fd = -1;
 
 	Data *data = (Data *)user_data;
 
@@ -156,6 +1244,26 @@ do_endsession_idle (gpointer user_data)
 	if (proxy == NULL)
 		goto done;
 
+	/* don't sleep through the scheduled wake up */
+	if (data->wake_time > 0) {
+		gboolean hibernates = g_str_equal (data->function, "Hibernate") ||
+                              g_str_equal (data->function, "SuspendThenHibernate");
+
+		wake = wake_alarm_arm (g_dbus_proxy_get_connection (proxy), data->wake_time, hibernates);
+		if (wake == NULL) {
+			g_clear_object (&proxy);
+			g_free (data);
+			goto done;
+		}
+	}
+
+	/* lock the screen and prepare the sleep at the same time,
+	 * the delay inhibitor keeps logind from sleeping before the lock */
+	if (data->lock)
+		inhibit_fd = sleep_inhibitor_take (proxy);
+	if (inhibit_fd >= 0)
+		lock = screen_lock_start (g_dbus_proxy_get_connection (proxy), inhibit_fd);
+
 	error = NULL;
 	reply = g_dbus_proxy_call_sync (proxy,
                                     data->function,
@@ -173,6 +1281,12 @@ do_endsession_idle (gpointer user_data)
 		g_variant_unref (reply);
 	}
 
+	if (lock)
+		screen_lock_finish (lock, reply != NULL);
+
+	if (wake)
+		wake_alarm_finish (wake, reply != NULL);
+
 	g_clear_object (&proxy);
 
 	g_free (data);
@@ -184,12 +1298,487 @@ done:
 	return FALSE;
 }
 
+/* Pick this host's slot, in seconds, inside a window of @window seconds.
+ * The slot only depends on the machine-id, so a wave of requests sent to
+ * many hosts at once spreads evenly over the window, and a host always
+ * lands on the same slot. */
+static gint
+schedule_slot_get (gint window)
+{
+	gint       i;
+	gchar     *machine_id = NULL;
+	guint8     digest[32];
+	gsize      digest_len = sizeof (digest);
+	guint64    value = 0;
+	GChecksum *checksum;
+
+	const char *paths[] = { "/etc/machine-id", "/var/lib/dbus/machine-id", NULL };
+
+	if (window <= 0)
+		return 0;
+
+	/* cloned images often ship an empty machine-id, which would put
+	 * every clone in the same slot */
+	for (i = 0; paths[i] && !machine_id; i++) {
+		if (g_file_get_contents (paths[i], &machine_id, NULL, NULL) &&
+            *g_strstrip (machine_id) == '\0')
+			g_clear_pointer (&machine_id, g_free);
+	}
+
+	if (machine_id == NULL) {
+		g_message ("No machine-id is set, spreading by the host name");
+		machine_id = g_strdup (g_get_host_name ());
+	}
+
+	checksum = g_checksum_new (G_CHECKSUM_SHA256);
+	g_checksum_update (checksum, (const guchar *)machine_id, -1);
+	g_checksum_get_digest (checksum, digest, &digest_len);
+	g_checksum_free (checksum);
+	g_free (machine_id);
+
+	for (i = 0; i < 8; i++)
+		value = (value << 8) | digest[i];
+
+	return value % window;
+}
+
+static void
+schedule_print (gint window, gint slot)
+{
+	GDateTime *now, *when;
+	gchar     *string;
+
+	now = g_date_time_new_now_local ();
+	when = g_date_time_add_seconds (now, slot + opt_delay / 1000.0);
+	string = g_date_time_format (when, "%Y-%m-%d %H:%M:%S");
+
+	g_print ("window=%d\n", window);
+	g_print ("slot=%d\n", slot);
+	g_print ("time=%s\n", string);
+
+	g_free (string);
+	g_date_time_unref (when);
+	g_date_time_unref (now);
+}
+
+static void query_start (void);
+
+static void
+query_print (void)
+{
+	gint     i;
+	GString *output;
+
+	output = g_string_new (opt_json ? "{" : NULL);
+
+	for (i = 0; CAPABILITIES[i]; i++) {
+		if (opt_json)
+			g_string_append_printf (output, "%s\"%s\": \"%s\"",
+                                    i > 0 ? ", " : "", CAPABILITIES[i], query.values[i]);
+		else
+			g_string_append_printf (output, "%s=%s\n", CAPABILITIES[i], query.values[i]);
+	}
+
+	if (opt_json)
+		g_string_append (output, "}\n");
+
+	/* in watch mode, only report changes */
+	if (g_strcmp0 (query.printed, output->str) != 0) {
+		fputs (output->str, stdout);
+		fflush (stdout);
+
+		g_free (query.printed);
+		query.printed = g_string_free (output, FALSE);
+	} else {
+		g_string_free (output, TRUE);
+	}
+}
+
+static void
+on_capability_finished (GObject      *source,
+                        GAsyncResult *result,
+                        gpointer      user_data)
+{
+	gint         i = GPOINTER_TO_INT (user_data);
+	GVariant    *reply;
+	const gchar *value = "na";
+
+	/* older logind versions lack some of the methods, report them as "na" */
+	reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source), result, NULL);
+	if (reply)
+		g_variant_get (reply, "(&s)", &value);
+
+	g_free (query.values[i]);
+	query.values[i] = g_strdup (value);
+
+	if (reply)
+		g_variant_unref (reply);
+
+	if (--query.pending > 0)
+		return;
+
+	query_print ();
+
+	if (query.dirty) {
+		query.dirty = FALSE;
+		query_start ();
+	} else if (!opt_watch) {
+		g_main_loop_quit (loop);
+	}
+}
+
+/* Issue all Can* calls at once over the same connection instead of
+ * waiting for each reply in turn */
+static void
+query_start (void)
+{
+	gint i;
+
+	if (query.pending > 0) {
+		query.dirty = TRUE;
+		return;
+	}
+
+	for (i = 0; CAPABILITIES[i]; i++) {
+		query.pending++;
+		g_dbus_connection_call (query.bus,
+                                "org.freedesktop.login1",
+                                "/org/freedesktop/login1",
+                                "org.freedesktop.login1.Manager",
+                                CAPABILITIES[i],
+                                NULL,
+                                G_VARIANT_TYPE ("(s)"),
+                                G_DBUS_CALL_FLAGS_NONE,
+                                -1, NULL,
+                                on_capability_finished,
+                                GINT_TO_POINTER (i));
+	}
+}
+
+/* logind announces inhibitor changes as property changes on the manager */
+static void
+on_manager_properties_changed (GDBusConnection *connection,
+                               const gchar     *sender_name,
+                               const gchar     *object_path,
+                               const gchar     *interface_name,
+                               const gchar     *signal_name,
+                               GVariant        *parameters,
+                               gpointer         user_data)
+{
+	query_start ();
+}
+
+static void
+on_login1_appeared (GDBusConnection *connection,
+                    const gchar     *name,
+                    const gchar     *name_owner,
+                    gpointer         user_data)
+{
+	query_start ();
+}
+
+static int
+do_query (void)
+{
+	gint    i;
+	guint   watch_id = 0, signal_id = 0;
+	GError *error = NULL;
+
+	query.bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
+	if (error != NULL) {
+		g_warning ("Failed to connect to the system bus: %s", error->message);
+		g_error_free (error);
+		return 1;
+	}
+
+	loop = g_main_loop_new (NULL, FALSE);
+
+	if (opt_watch) {
+		signal_id = g_dbus_connection_signal_subscribe (query.bus,
+                                                        "org.freedesktop.login1",
+                                                        "org.freedesktop.DBus.Properties",
+                                                        "PropertiesChanged",
+                                                        "/org/freedesktop/login1",
+                                                        NULL,
+                                                        G_DBUS_SIGNAL_FLAGS_NONE,
+                                                        on_manager_properties_changed,
+                                                        NULL, NULL);
+
+		/* also covers the initial query, and logind restarts */
+		watch_id = g_bus_watch_name_on_connection (query.bus,
+                                                   "org.freedesktop.login1",
+                                                   G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                                   on_login1_appeared,
+                                                   NULL, NULL, NULL);
+	} else {
+		query_start ();
+	}
+
+	g_main_loop_run (loop);
+	g_main_loop_unref (loop);
+	loop = NULL;
+
+	if (watch_id > 0)
+		g_bus_unwatch_name (watch_id);
+	if (signal_id > 0)
+		g_dbus_connection_signal_unsubscribe (query.bus, signal_id);
+
+	for (i = 0; CAPABILITIES[i]; i++)
+		g_free (query.values[i]);
+	g_free (query.printed);
+	g_clear_object (&query.bus);
+
+	return 0;
+}
+
+static GVariant *
+dbus_property_get (GDBusConnection *bus,
+                   const gchar     *name,
+                   const gchar     *object_path,
+                   const gchar     *interface_name,
+                   const gchar     *property)
+{
+	GVariant *reply, *value = NULL;
+
+	reply = g_dbus_connection_call_sync (bus,
+                                         name,
+                                         object_path,
+                                         "org.freedesktop.DBus.Properties",
+                                         "Get",
+                                         g_variant_new ("(ss)", interface_name, property),
+                                         G_VARIANT_TYPE ("(v)"),
+                                         G_DBUS_CALL_FLAGS_NONE,
+                                         -1, NULL, NULL);
+	if (reply) {
+		g_variant_get (reply, "(v)", &value);
+		g_variant_unref (reply);
+	}
+
+	return value;
+}
+
+/* Run the configured action through the same paths as the command line */
+static void
+idle_policy_act (void)
+{
+	Data *data;
+
+	policy.acted_since = policy.idle_since;
+
+	g_message ("Session idle since %" G_GUINT64_FORMAT " s, running %s",
+               (g_get_real_time () - policy.idle_since) / G_USEC_PER_SEC, policy.action);
+
+	if (g_str_equal (policy.action, "logout")) {
+		do_logout_idle (NULL);
+		return;
+	}
+
+	data = g_new0 (Data, 1);
+	data->error_message = "Failed to run idle action";
+
+	if (g_str_equal (policy.action, "poweroff")) {
+		data->function = "PowerOff";
+	} else if (g_str_equal (policy.action, "suspend")) {
+		data->function = "Suspend";
+		data->lock = TRUE;
+	} else if (g_str_equal (policy.action, "hibernate")) {
+		data->function = "Hibernate";
+		data->lock = TRUE;
+	} else if (g_str_equal (policy.action, "hybrid-sleep")) {
+		data->function = "HybridSleep";
+		data->lock = TRUE;
+	} else if (g_str_equal (policy.action, "suspend-then-hibernate")) {
+		data->function = "SuspendThenHibernate";
+		data->lock = TRUE;
+	} else if (g_str_equal (policy.action, "sleep")) {
+		data->function = sleep_function_get ();
+		data->lock = TRUE;
+	}
+
+	if (data->function) {
+		do_endsession_idle (data);
+	} else {
+		g_warning ("Unknown idle action '%s' in %s", policy.action, LOGOUT_CONFIG_FILE);
+		g_free (data);
+	}
+}
+
+static void idle_policy_update (void);
+
+static gboolean
+on_idle_policy_timeout (gpointer user_data)
+{
+	policy.timeout_id = 0;
+
+	/* conditions are checked again before acting */
+	idle_policy_update ();
+
+	return FALSE;
+}
+
+/* Called on every change of the session idle hint, the inhibitors or the
+ * power source. Only a single timeout runs, and only while the session
+ * is idle, so an active session costs no wake ups at all */
+static void
+idle_policy_update (void)
+{
+	gboolean  idle = FALSE, on_battery = FALSE, inhibited = FALSE;
+	guint64   idle_since = 0;
+	gint64    remaining;
+	gint      threshold;
+	GVariant *value;
+
+	if (policy.timeout_id > 0) {
+		g_source_remove (policy.timeout_id);
+		policy.timeout_id = 0;
+	}
+
+	value = dbus_property_get (policy.bus, "org.freedesktop.login1", policy.session_path,
+                               "org.freedesktop.login1.Session", "IdleHint");
+	if (value) {
+		idle = g_variant_get_boolean (value);
+		g_variant_unref (value);
+	}
+
+	value = dbus_property_get (policy.bus, "org.freedesktop.login1", policy.session_path,
+                               "org.freedesktop.login1.Session", "IdleSinceHint");
+	if (value) {
+		idle_since = g_variant_get_uint64 (value);
+		g_variant_unref (value);
+	}
+
+	value = dbus_property_get (policy.bus, "org.freedesktop.login1", "/org/freedesktop/login1",
+                               "org.freedesktop.login1.Manager", "BlockInhibited");
+	if (value) {
+		gchar **what = g_strsplit (g_variant_get_string (value, NULL), ":", -1);
+		inhibited = g_strv_contains ((const gchar * const *)what, "idle");
+		g_strfreev (what);
+		g_variant_unref (value);
+	}
+
+	value = dbus_property_get (policy.bus, "org.freedesktop.UPower", "/org/freedesktop/UPower",
+                               "org.freedesktop.UPower", "OnBattery");
+	if (value) {
+		on_battery = g_variant_get_boolean (value);
+		g_variant_unref (value);
+	}
+
+	/* act once per idle period, e.g. not again right after a resume */
+	if (!idle || inhibited || idle_since == 0 || idle_since == policy.acted_since)
+		return;
+
+	threshold = on_battery ? policy.battery_timeout : policy.timeout;
+	if (threshold <= 0)
+		return;
+
+	policy.idle_since = idle_since;
+	remaining = threshold - ((gint64) g_get_real_time () - (gint64) idle_since) / G_USEC_PER_SEC;
+
+	if (remaining <= 0)
+		idle_policy_act ();
+	else
+		policy.timeout_id = g_timeout_add_seconds (remaining, on_idle_policy_timeout, NULL);
+}
+
+static void
+on_idle_policy_changed (GDBusConnection *connection,
+                        const gchar     *sender_name,
+                        const gchar     *object_path,
+                        const gchar     *interface_name,
+                        const gchar     *signal_name,
+                        GVariant        *parameters,
+                        gpointer         user_data)
+{
+	idle_policy_update ();
+}
+
+static int
+do_idle_policy (void)
+{
+	guint      i, signal_ids[3];
+	GError    *error = NULL;
+	GMainLoop *policy_loop;
+
+	policy.action = logout_config_get_string ("Idle", "Action", NULL);
+	policy.timeout = logout_config_get_integer ("Idle", "Timeout", 0);
+	policy.battery_timeout = logout_config_get_integer ("Idle", "BatteryTimeout", policy.timeout);
+
+	if (policy.action == NULL || (policy.timeout <= 0 && policy.battery_timeout <= 0)) {
+		display_error ("No idle action configured in " LOGOUT_CONFIG_FILE);
+		g_free (policy.action);
+		return 1;
+	}
+
+	policy.bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
+	if (error != NULL) {
+		g_warning ("Failed to connect to the system bus: %s", error->message);
+		g_error_free (error);
+		g_free (policy.action);
+		return 1;
+	}
+
+	policy.session_path = login1_session_path_get (policy.bus);
+	if (policy.session_path == NULL) {
+		g_warning ("Failed to find the session");
+		g_clear_object (&policy.bus);
+		g_free (policy.action);
+		return 1;
+	}
+
+	/* the session for the idle hint, the manager for the inhibitors and
+	 * UPower for the power source */
+	signal_ids[0] = g_dbus_connection_signal_subscribe (policy.bus,
+                                                        "org.freedesktop.login1",
+                                                        "org.freedesktop.DBus.Properties",
+                                                        "PropertiesChanged",
+                                                        policy.session_path,
+                                                        NULL,
+                                                        G_DBUS_SIGNAL_FLAGS_NONE,
+                                                        on_idle_policy_changed,
+                                                        NULL, NULL);
+	signal_ids[1] = g_dbus_connection_signal_subscribe (policy.bus,
+                                                        "org.freedesktop.login1",
+                                                        "org.freedesktop.DBus.Properties",
+                                                        "PropertiesChanged",
+                                                        "/org/freedesktop/login1",
+                                                        NULL,
+                                                        G_DBUS_SIGNAL_FLAGS_NONE,
+                                                        on_idle_policy_changed,
+                                                        NULL, NULL);
+	signal_ids[2] = g_dbus_connection_signal_subscribe (policy.bus,
+                                                        "org.freedesktop.UPower",
+                                                        "org.freedesktop.DBus.Properties",
+                                                        "PropertiesChanged",
+                                                        "/org/freedesktop/UPower",
+                                                        NULL,
+                                                        G_DBUS_SIGNAL_FLAGS_NONE,
+                                                        on_idle_policy_changed,
+                                                        NULL, NULL);
+
+	idle_policy_update ();
+
+	/* the action paths quit the global loop, keep watching after a resume */
+	policy_loop = g_main_loop_new (NULL, FALSE);
+	g_main_loop_run (policy_loop);
+	g_main_loop_unref (policy_loop);
+
+	for (i = 0; i < G_N_ELEMENTS (signal_ids); i++)
+		g_dbus_connection_signal_unsubscribe (policy.bus, signal_ids[i]);
+
+	g_clear_object (&policy.bus);
+	g_free (policy.session_path);
+	g_free (policy.action);
+
+	return 0;
+}
+
 int
 main (int argc, char *argv[])
 {
 	GError *error;
 	GOptionContext *ctx;
 	int conflicting_options;
+	gint64 wake_time = 0;
 
 	error = NULL;
 	ctx = g_option_context_new ("");
@@ -208,16 +1797,65 @@ main (int argc, char *argv[])
 		conflicting_options++;
 	if (opt_reboot)
 		conflicting_options++;
+	if (opt_soft_reboot)
+		conflicting_options++;
 	if (opt_hibernate)
 		conflicting_options++;
 	if (opt_suspend)
 		conflicting_options++;
+	if (opt_hybrid_sleep)
+		conflicting_options++;
+	if (opt_suspend_then_hibernate)
+		conflicting_options++;
+	if (opt_sleep)
+		conflicting_options++;
+	if (opt_query)
+		conflicting_options++;
+	if (opt_idle_policy)
+		conflicting_options++;
 
 	if (conflicting_options > 1) {
 		display_error ("Program called with conflicting options");
 		exit (1);
 	}
 
+	/* before any action runs, so that it is not silently ignored */
+	if (opt_wake_at) {
+		if (!opt_suspend && !opt_hibernate && !opt_hybrid_sleep &&
+            !opt_suspend_then_hibernate && !opt_sleep) {
+			display_error ("--wake-at needs a sleep action");
+			exit (1);
+		}
+
+		wake_time = wake_time_parse (opt_wake_at);
+		if (wake_time <= g_get_real_time () / G_USEC_PER_SEC) {
+			display_error ("Invalid or past wake up time");
+			exit (1);
+		}
+	}
+
+	if (opt_query)
+		return do_query ();
+
+	if (opt_idle_policy)
+		return do_idle_policy ();
+
+	if (opt_window < 0 || opt_window > G_MAXINT / 1000 - opt_delay / 1000) {
+		display_error ("Window out of range");
+		exit (1);
+	}
+
+	if (opt_window > 0 || opt_dry_run) {
+		gint slot = schedule_slot_get (opt_window);
+
+		if (opt_dry_run) {
+			schedule_print (opt_window, slot);
+			return 0;
+		}
+
+		opt_delay += slot * 1000;
+	}
+
 	if (opt_logout) {
 		if (opt_delay > 0) {
 			g_timeout_add (opt_delay, (GSourceFunc)do_logout_idle, NULL);
@@ -232,6 +1870,20 @@ main (int argc, char *argv[])
 		return 0;
 	} 
 
+	if (opt_soft_reboot) {
+		if (opt_delay > 0) {
+			g_timeout_add (opt_delay, (GSourceFunc)do_soft_reboot_idle, NULL);
+			loop = g_main_loop_new (NULL, FALSE);
+
+			g_main_loop_run (loop);
+			g_main_loop_unref (loop);
+		} else {
+			do_soft_reboot_idle (NULL);
+		}
+
+		return 0;
+	}
+
 	Data *data = g_new0 (Data, 1);
 
 	if (opt_poweroff) {
@@ -243,25 +1895,44 @@ main (int argc, char *argv[])
 	} else if (opt_hibernate) {
 		data->function = "Hibernate";
 		data->error_message = "Failed to call hibernate";
+		data->lock = !opt_no_lock;
 	} else if (opt_suspend) {
 		data->function = "Suspend";
 		data->error_message = "Failed to call suspend";
+		data->lock = !opt_no_lock;
+	} else if (opt_hybrid_sleep) {
+		data->function = "HybridSleep";
+		data->error_message = "Failed to call hybrid sleep";
+		data->lock = !opt_no_lock;
+	} else if (opt_suspend_then_hibernate) {
+		data->function = "SuspendThenHibernate";
+		data->error_message = "Failed to call suspend then hibernate";
+		data->lock = !opt_no_lock;
+	} else if (opt_sleep) {
+		data->function = sleep_function_get ();
+		data->error_message = "Failed to call sleep";
+		data->lock = !opt_no_lock;
 	} else {
 		data->function = NULL;
 		data->error_message = NULL;
 	}
 
-	if (opt_poweroff || opt_reboot || opt_suspend || opt_hibernate) {
-		if (opt_delay > 0) {
-			g_timeout_add (opt_delay, (GSourceFunc)do_endsession_idle ,data);
+	if (data->function == NULL) {
+		g_free (data);
+		return 0;
+	}
 
-			loop = g_main_loop_new (NULL, FALSE);
+	data->wake_time = wake_time;
 
-			g_main_loop_run (loop);
-			g_main_loop_unref (loop);
-		} else {
-			do_endsession_idle (data);
-		}
+	if (opt_delay > 0) {
+		g_timeout_add (opt_delay, (GSourceFunc)do_endsession_idle ,data);
+
+		loop = g_main_loop_new (NULL, FALSE);
+
+		g_main_loop_run (loop);
+		g_main_loop_unref (loop);
+	} else {
+		do_endsession_idle (data);
 	}
 
 	return 0;
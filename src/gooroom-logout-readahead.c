@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2018-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* Run at login: warm the page cache with the files recorded by
+ * "gooroom-logout --record-readahead", so that the first logout dialog
+ * of the session does not wait for the disk. Accounts without their own
+ * manifest use the one recorded by "gooroom-logout --record-system-readahead". */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+
+#include "logout-readahead.h"
+
+
+int
+main (int argc, char **argv)
+{
+	gchar  *manifest;
+	GError *error = NULL;
+
+	if (argc > 1)
+		manifest = g_strdup (argv[1]);
+	else
+		manifest = logout_readahead_manifest_path ();
+
+	if (!logout_readahead_replay (manifest, &error) && argc == 1 &&
+        g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+		g_clear_error (&error);
+		g_free (manifest);
+
+		manifest = logout_readahead_system_manifest_path ();
+		logout_readahead_replay (manifest, &error);
+	}
+
+	if (error != NULL) {
+		/* nothing recorded yet is not an error */
+		if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+			g_warning ("Failed to read ahead %s: %s", manifest, error->message);
+		g_error_free (error);
+	}
+
+	g_free (manifest);
+
+	return 0;
+}
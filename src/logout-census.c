@@ -0,0 +1,248 @@
+/* 
+ * Copyright (C) 2018-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* Only built with --enable-census. Run with GOOROOM_LOGOUT_CENSUS=1 to
+ * get, at each phase boundary, the number of allocations made since the
+ * previous one, the live GObject instances and the peak RSS, and a list
+ * of the instances still alive at exit. tests/census-check.sh compares
+ * the latter with tests/census.baseline. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "logout-census.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <glib-object.h>
+
+extern void *__libc_malloc  (size_t size);
+extern void *__libc_calloc  (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+extern void  __libc_free    (void *ptr);
+extern void *__libc_memalign (size_t alignment, size_t size);
+extern void *__libc_valloc  (size_t size);
+extern void *__libc_pvalloc (size_t size);
+
+static guint64 n_allocs = 0;
+static guint64 n_frees  = 0;
+
+static gboolean census_enabled = FALSE;
+static guint64  phase_allocs   = 0;
+static guint64  phase_frees    = 0;
+
+
+/* The executable's definitions take precedence over the C library's for
+ * every shared library as well, so this sees GTK's allocations too. Only
+ * atomics here, anything that allocates would recurse. */
+void *
+malloc (size_t size)
+{
+	__atomic_add_fetch (&n_allocs, 1, __ATOMIC_RELAXED);
+	return __libc_malloc (size);
+}
+
+void *
+calloc (size_t nmemb, size_t size)
+{
+	__atomic_add_fetch (&n_allocs, 1, __ATOMIC_RELAXED);
+	return __libc_calloc (nmemb, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+	/* like glibc, realloc (ptr, 0) frees */
+	if (ptr == NULL)
+		__atomic_add_fetch (&n_allocs, 1, __ATOMIC_RELAXED);
+	else if (size == 0)
+		__atomic_add_fetch (&n_frees, 1, __ATOMIC_RELAXED);
+	return __libc_realloc (ptr, size);
+}
+
+void *
+reallocarray (void *ptr, size_t nmemb, size_t size)
+{
+	size_t total;
+
+	if (__builtin_mul_overflow (nmemb, size, &total)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	return realloc (ptr, total);
+}
+
+/* the aligned allocators are released with free () like the others,
+ * so they have to be counted too to keep live-blocks balanced */
+void *
+memalign (size_t alignment, size_t size)
+{
+	__atomic_add_fetch (&n_allocs, 1, __ATOMIC_RELAXED);
+	return __libc_memalign (alignment, size);
+}
+
+void *
+aligned_alloc (size_t alignment, size_t size)
+{
+	return memalign (alignment, size);
+}
+
+int
+posix_memalign (void **memptr, size_t alignment, size_t size)
+{
+	void *ptr;
+
+	if (alignment % sizeof (void *) != 0 || (alignment & (alignment - 1)) != 0 || alignment == 0)
+		return EINVAL;
+
+	ptr = memalign (alignment, size);
+	if (ptr == NULL)
+		return ENOMEM;
+
+	*memptr = ptr;
+
+	return 0;
+}
+
+void *
+valloc (size_t size)
+{
+	__atomic_add_fetch (&n_allocs, 1, __ATOMIC_RELAXED);
+	return __libc_valloc (size);
+}
+
+void *
+pvalloc (size_t size)
+{
+	__atomic_add_fetch (&n_allocs, 1, __ATOMIC_RELAXED);
+	return __libc_pvalloc (size);
+}
+
+void
+free (void *ptr)
+{
+	if (ptr != NULL)
+		__atomic_add_fetch (&n_frees, 1, __ATOMIC_RELAXED);
+	__libc_free (ptr);
+}
+
+static guint
+type_instances_count (GType type, gboolean print)
+{
+	GType *children;
+	guint  i, n_children, count;
+
+	count = g_type_get_instance_count (type);
+	if (print && count > 0)
+		g_printerr ("census:   %s: %u\n", g_type_name (type), count);
+
+	children = g_type_children (type, &n_children);
+	for (i = 0; i < n_children; i++)
+		count += type_instances_count (children[i], print);
+	g_free (children);
+
+	return count;
+}
+
+void
+logout_census_init (int argc, char **argv)
+{
+	const gchar *debug;
+
+	if (g_getenv ("GOOROOM_LOGOUT_CENSUS") == NULL)
+		return;
+
+	/* instance counting has to be on before the type system starts,
+	 * which happens when GObject is loaded, so start over with it */
+	debug = g_getenv ("GOBJECT_DEBUG");
+	if (debug == NULL || strstr (debug, "instance-count") == NULL) {
+		gchar *value = debug
+			? g_strdup_printf ("%s:instance-count", debug)
+			: g_strdup ("instance-count");
+
+		g_setenv ("GOBJECT_DEBUG", value, TRUE);
+		g_free (value);
+
+		execv ("/proc/self/exe", argv);
+		g_warning ("Failed to restart with instance counting: %s", g_strerror (errno));
+	}
+
+	census_enabled = TRUE;
+	logout_census_phase ("init");
+}
+
+void
+logout_census_phase (const gchar *name)
+{
+	guint64       allocs, frees;
+	struct rusage usage;
+
+	if (!census_enabled)
+		return;
+
+	allocs = __atomic_load_n (&n_allocs, __ATOMIC_RELAXED);
+	frees = __atomic_load_n (&n_frees, __ATOMIC_RELAXED);
+	getrusage (RUSAGE_SELF, &usage);
+
+	g_printerr ("census: %-18s allocs=+%" G_GUINT64_FORMAT " frees=+%" G_GUINT64_FORMAT
+                " live-blocks=%" G_GINT64_FORMAT " gobjects=%u peak-rss=%ldkB\n",
+                name,
+                allocs - phase_allocs,
+                frees - phase_frees,
+                (gint64) (allocs - frees),
+                type_instances_count (G_TYPE_OBJECT, FALSE),
+                usage.ru_maxrss);
+
+	/* the report itself allocates, leave it out of the next phase */
+	phase_allocs = __atomic_load_n (&n_allocs, __ATOMIC_RELAXED);
+	phase_frees = __atomic_load_n (&n_frees, __ATOMIC_RELAXED);
+}
+
+/* GOOROOM_LOGOUT_CENSUS_AUTOCLOSE=<ms> closes the dialog by itself, so
+ * that "make check" can take a census without anyone clicking */
+guint
+logout_census_autoclose (void)
+{
+	const gchar *value;
+
+	if (!census_enabled)
+		return 0;
+
+	value = g_getenv ("GOOROOM_LOGOUT_CENSUS_AUTOCLOSE");
+
+	return value ? (guint) MAX (atoi (value), 0) : 0;
+}
+
+void
+logout_census_report (void)
+{
+	if (!census_enabled)
+		return;
+
+	logout_census_phase ("exit");
+
+	g_printerr ("census: instances alive at exit\n");
+	type_instances_count (G_TYPE_OBJECT, TRUE);
+}
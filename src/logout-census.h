@@ -0,0 +1,44 @@
+/* 
+ * Copyright (C) 2018-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __LOGOUT_CENSUS_H__
+#define __LOGOUT_CENSUS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#ifdef ENABLE_CENSUS
+void          logout_census_init   (int          argc,
+                                    char       **argv);
+
+void          logout_census_phase  (const gchar *name);
+
+guint         logout_census_autoclose (void);
+
+void          logout_census_report (void);
+#else
+#define logout_census_init(argc, argv)
+#define logout_census_phase(name)
+#define logout_census_autoclose() 0
+#define logout_census_report()
+#endif
+
+G_END_DECLS
+
+#endif
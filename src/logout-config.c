@@ -0,0 +1,95 @@
+/* 
+ * Copyright (C) 2018-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "logout-config.h"
+
+
+static GKeyFile *
+logout_config_get (void)
+{
+	static GKeyFile *keyfile = NULL;
+
+	if (keyfile == NULL) {
+		const gchar *path;
+		GError      *error = NULL;
+
+		keyfile = g_key_file_new ();
+
+		/* the tests run against a fixed policy, not the host's one */
+		path = g_getenv ("GOOROOM_LOGOUT_CONFIG");
+		if (path == NULL)
+			path = LOGOUT_CONFIG_FILE;
+
+		/* site policy is optional, go with the defaults without it */
+		if (!g_key_file_load_from_file (keyfile, path, G_KEY_FILE_NONE, &error)) {
+			if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+				g_warning ("Failed to load %s: %s", path, error->message);
+			g_error_free (error);
+		}
+	}
+
+	return keyfile;
+}
+
+gchar *
+logout_config_get_string (const gchar *group,
+                          const gchar *key,
+                          const gchar *default_value)
+{
+	gchar *value;
+
+	value = g_key_file_get_string (logout_config_get (), group, key, NULL);
+	if (value == NULL)
+		value = g_strdup (default_value);
+
+	return value;
+}
+
+gint
+logout_config_get_integer (const gchar *group,
+                           const gchar *key,
+                           gint         default_value)
+{
+	gint    value;
+	GError *error = NULL;
+
+	value = g_key_file_get_integer (logout_config_get (), group, key, &error);
+	if (error != NULL) {
+		g_error_free (error);
+		value = default_value;
+	}
+
+	return value;
+}
+
+gboolean
+logout_config_get_boolean (const gchar *group,
+                           const gchar *key,
+                           gboolean     default_value)
+{
+	gboolean  value;
+	GError   *error = NULL;
+
+	value = g_key_file_get_boolean (logout_config_get (), group, key, &error);
+	if (error != NULL) {
+		g_error_free (error);
+		value = default_value;
+	}
+
+	return value;
+}
@@ -20,6 +20,12 @@
  * was written by Owen Taylor <otaylor@redhat.com>.
  */
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "logout-census.h"
+#include "logout-config.h"
 #include "logout-dialog.h"
 
 #include <gtk/gtk.h>
@@ -54,11 +60,17 @@ enum {
 	SYSTEM_LOGOUT = 0,
 	SYSTEM_HIBERNATE,
 	SYSTEM_SUSPEND,
+	SYSTEM_HYBRID_SLEEP,
+	SYSTEM_SUSPEND_THEN_HIBERNATE,
 	SYSTEM_RESTART,
+	SYSTEM_SOFT_RESTART,
 	SYSTEM_SHUTDOWN,
 	SYSTEM_CANCEL
 };
 
+/* bound for the systemd query made while the dialog is being built */
+#define SYSTEMD_QUERY_TIMEOUT 500
+
 enum {
 	LOGOUT_NORMAL = 0,
 	LOGOUT_NO_CONFIRMATION,
@@ -89,12 +101,30 @@ static const struct {
       N_("Save user sessions in hard disk and turn off the computer.")
 	},
 
+	{ SYSTEM_HYBRID_SLEEP,
+      N_("H_ybrid Sleep"),
+      "system-suspend-symbolic",
+      N_("Save user sessions in memory and hard disk and put the computer into sleep state.")
+	},
+
+	{ SYSTEM_SUSPEND_THEN_HIBERNATE,
+      N_("Suspend then H_ibernate"),
+      "system-hibernate-symbolic",
+      N_("Put the computer into sleep state and hibernate it after a while.")
+	},
+
 	{ SYSTEM_RESTART,
       N_("_Restart"),
       "system-restart-symbolic",
       N_("Shut down and automatically restart the computer?")
 	},
 
+	{ SYSTEM_SOFT_RESTART,
+      N_("S_oft Restart"),
+      "view-refresh-symbolic",
+      N_("Restart all programs without restarting the computer.")
+	},
+
 	{ SYSTEM_SHUTDOWN,
       N_("Shut _Down"),
       "system-shutdown-symbolic",
@@ -250,7 +280,9 @@ is_function_available (const char *function)
 	if (!g_str_equal (function, "CanReboot") &&
 	    !g_str_equal (function, "CanPowerOff") &&
 	    !g_str_equal (function, "CanSuspend") &&
-        !g_str_equal (function, "CanHibernate")) {
+        !g_str_equal (function, "CanHibernate") &&
+        !g_str_equal (function, "CanHybridSleep") &&
+        !g_str_equal (function, "CanSuspendThenHibernate")) {
 		return FALSE;
 	}
 
@@ -276,19 +308,100 @@ is_function_available (const char *function)
 
 			g_variant_unref (r);
 		}
+
+		g_object_unref (proxy);
+	}
+
+	return result;
+}
+
+/* logind restarts only the userspace with SD_LOGIND_SOFT_REBOOT from
+ * systemd 254 on, with an older one the soft restart would be a full one.
+ * @can_reboot is the CanReboot answer already fetched for the Restart row. */
+static gboolean
+is_soft_restart_available (gboolean can_reboot)
+{
+	gboolean         result = FALSE;
+	const gchar     *version;
+	GDBusConnection *bus;
+	GVariant        *r, *value;
+
+	if (!can_reboot)
+		return FALSE;
+
+	bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, NULL);
+	if (bus == NULL)
+		return FALSE;
+
+	r = g_dbus_connection_call_sync (bus,
+			"org.freedesktop.systemd1",
+			"/org/freedesktop/systemd1",
+			"org.freedesktop.DBus.Properties",
+			"Get",
+			g_variant_new ("(ss)", "org.freedesktop.systemd1.Manager", "Version"),
+			G_VARIANT_TYPE ("(v)"),
+			G_DBUS_CALL_FLAGS_NONE,
+			SYSTEMD_QUERY_TIMEOUT,
+			NULL,
+			NULL);
+
+	if (r) {
+		g_variant_get (r, "(v)", &value);
+		if (g_variant_is_of_type (value, G_VARIANT_TYPE_STRING)) {
+			/* "255.4-1ubuntu8", "v256~rc1", ... */
+			version = g_variant_get_string (value, NULL);
+			while (*version && !g_ascii_isdigit (*version))
+				version++;
+			result = g_ascii_strtoull (version, NULL, 10) >= 254;
+		}
+
+		g_variant_unref (value);
+		g_variant_unref (r);
 	}
 
+	g_object_unref (bus);
+
 	return result;
 }
 
+/* Site policy may narrow the sleep actions down to a single one,
+ * returns -1 when all available sleep actions are offered. The returned
+ * action has been checked to be available, the caller need not ask again. */
+static gint
+default_sleep_action_get (void)
+{
+	gchar *action;
+	gint   id = -1;
+
+	action = logout_config_get_string ("Sleep", "DefaultAction", NULL);
+	if (action == NULL)
+		return -1;
+
+	if (g_str_equal (action, "suspend") && is_function_available ("CanSuspend"))
+		id = SYSTEM_SUSPEND;
+	else if (g_str_equal (action, "hibernate") && is_function_available ("CanHibernate"))
+		id = SYSTEM_HIBERNATE;
+	else if (g_str_equal (action, "hybrid-sleep") && is_function_available ("CanHybridSleep"))
+		id = SYSTEM_HYBRID_SLEEP;
+	else if (g_str_equal (action, "suspend-then-hibernate") && is_function_available ("CanSuspendThenHibernate"))
+		id = SYSTEM_SUSPEND_THEN_HIBERNATE;
+
+	g_free (action);
+
+	return id;
+}
+
 static gboolean
 do_endsession (const gchar *function)
 {
 	if (!g_str_equal (function, "logout") &&
 	    !g_str_equal (function, "reboot") &&
+        !g_str_equal (function, "soft-reboot") &&
         !g_str_equal (function, "suspend") &&
         !g_str_equal (function, "poweroff") &&
-        !g_str_equal (function, "hibernate")) {
+        !g_str_equal (function, "hibernate") &&
+        !g_str_equal (function, "hybrid-sleep") &&
+        !g_str_equal (function, "suspend-then-hibernate")) {
 		return FALSE;
 	}
 
@@ -333,10 +446,22 @@ on_system_command_button_clicked (GtkWidget *button, gpointer data)
 			function = "hibernate";
 			break;
 
+		case SYSTEM_HYBRID_SLEEP:
+			function = "hybrid-sleep";
+			break;
+
+		case SYSTEM_SUSPEND_THEN_HIBERNATE:
+			function = "suspend-then-hibernate";
+			break;
+
 		case SYSTEM_RESTART:
 			function = "reboot";
 			break;
 
+		case SYSTEM_SOFT_RESTART:
+			function = "soft-reboot";
+			break;
+
 		case SYSTEM_SHUTDOWN:
 			function = "poweroff";
 			break;
@@ -358,12 +483,19 @@ on_system_command_button_clicked (GtkWidget *button, gpointer data)
 static void
 logout_dialog_init (LogoutDialog *dialog)
 {
-	GtkWidget *hbox, *content_area;
+	GtkWidget *box_logo, *content_area;
 	LogoutDialogPrivate *priv;
 
 	priv = dialog->priv = logout_dialog_get_instance_private (dialog);
 
-	gtk_widget_init_template (GTK_WIDGET (dialog));
+	/* The widget tree is built in code rather than from a GtkBuilder
+	 * template, and the logo and button boxes are filled before being
+	 * added to the dialog, so styles are only computed once for them */
+	gtk_widget_set_name (GTK_WIDGET (dialog), "logout-dialog");
+	gtk_widget_set_can_focus (GTK_WIDGET (dialog), FALSE);
+	gtk_window_set_position (GTK_WINDOW (dialog), GTK_WIN_POS_CENTER_ALWAYS);
+	gtk_window_set_default_size (GTK_WINDOW (dialog), 320, -1);
+	gtk_window_set_type_hint (GTK_WINDOW (dialog), GDK_WINDOW_TYPE_HINT_DIALOG);
 
 G_GNUC_BEGIN_IGNORE_DEPRECATIONS
 	content_area = gtk_dialog_get_content_area (GTK_DIALOG (dialog));
@@ -372,17 +504,42 @@ G_GNUC_BEGIN_IGNORE_DEPRECATIONS
 	gtk_widget_hide (gtk_dialog_get_action_area (GTK_DIALOG (dialog)));
 G_GNUC_END_IGNORE_DEPRECATIONS
 
+	box_logo = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
+	gtk_widget_set_name (box_logo, "logout-dialog-logo");
+
+	priv->img_logo = gtk_image_new ();
+	gtk_box_pack_start (GTK_BOX (box_logo), priv->img_logo, TRUE, TRUE, 0);
+
 	GdkPixbuf *pixbuf = gdk_pixbuf_new_from_resource_at_scale ("/kr/gooroom/logout/logo.svg", 160, -1, TRUE, NULL);
 	if (pixbuf) {
 		gtk_image_set_from_pixbuf (GTK_IMAGE (priv->img_logo), pixbuf);
 		g_object_unref (pixbuf);
 	}
 
+	priv->box_button = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
+
 	gint i;
+	gint default_sleep = default_sleep_action_get ();
+	gboolean can_reboot = is_function_available ("CanReboot");
 	for (i = 0; DATA[i].id != -1; i++ ) {
 		GtkWidget *button = NULL;
-		if (DATA[i].id == SYSTEM_RESTART) {
-			if (is_function_available ("CanReboot"))
+		if (default_sleep != -1 &&
+            (DATA[i].id == SYSTEM_SUSPEND ||
+             DATA[i].id == SYSTEM_HIBERNATE ||
+             DATA[i].id == SYSTEM_HYBRID_SLEEP ||
+             DATA[i].id == SYSTEM_SUSPEND_THEN_HIBERNATE) &&
+            DATA[i].id != default_sleep) {
+			continue;
+		}
+
+		if (DATA[i].id == default_sleep) {
+			button = gtk_button_new ();
+		} else if (DATA[i].id == SYSTEM_RESTART) {
+			if (can_reboot)
+				button = gtk_button_new ();
+		} else if (DATA[i].id == SYSTEM_SOFT_RESTART) {
+			if (logout_config_get_boolean ("Restart", "SoftRestart", FALSE) &&
+                is_soft_restart_available (can_reboot))
 				button = gtk_button_new ();
 		} else if (DATA[i].id == SYSTEM_SHUTDOWN) {
 			if (is_function_available ("CanPowerOff"))
@@ -393,6 +550,12 @@ G_GNUC_END_IGNORE_DEPRECATIONS
 		} else if (DATA[i].id == SYSTEM_HIBERNATE) {
 			if (is_function_available ("CanHibernate"))
 				button = gtk_button_new ();
+		} else if (DATA[i].id == SYSTEM_HYBRID_SLEEP) {
+			if (is_function_available ("CanHybridSleep"))
+				button = gtk_button_new ();
+		} else if (DATA[i].id == SYSTEM_SUSPEND_THEN_HIBERNATE) {
+			if (is_function_available ("CanSuspendThenHibernate"))
+				button = gtk_button_new ();
 		} else {
 			button = gtk_button_new ();
 		}
@@ -420,21 +583,21 @@ G_GNUC_END_IGNORE_DEPRECATIONS
 		gtk_label_set_use_markup (GTK_LABEL (label), TRUE);
 		gtk_box_pack_start (GTK_BOX (hbox), label, FALSE, FALSE, 0);
 
-		gtk_widget_show_all (button);
-
 		g_signal_connect (G_OBJECT (button), "clicked",
 				G_CALLBACK (on_system_command_button_clicked), dialog);
 	}
+
+	/* showing is cheap while the boxes are not in the dialog yet */
+	gtk_widget_show_all (box_logo);
+	gtk_widget_show_all (priv->box_button);
+
+	gtk_box_pack_start (GTK_BOX (content_area), box_logo, FALSE, TRUE, 0);
+	gtk_box_pack_start (GTK_BOX (content_area), priv->box_button, TRUE, TRUE, 0);
 }
 
 static void
 logout_dialog_class_init (LogoutDialogClass *class)
 {
-	gtk_widget_class_set_template_from_resource (GTK_WIDGET_CLASS (class),
-			"/kr/gooroom/logout/logout-dialog.ui");
-
-	gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (class), LogoutDialog, img_logo);
-	gtk_widget_class_bind_template_child_private (GTK_WIDGET_CLASS (class), LogoutDialog, box_button);
 }
 
 static void
@@ -489,6 +652,19 @@ logout_dialog_run (GtkWidget *dialog, gboolean grab_input)
 	return ret;
 }
 
+#ifdef ENABLE_CENSUS
+static guint census_autoclose_id = 0;
+
+static gboolean
+on_census_autoclose (gpointer data)
+{
+	census_autoclose_id = 0;
+	gtk_dialog_response (GTK_DIALOG (data), GTK_RESPONSE_NONE);
+
+	return FALSE;
+}
+#endif
+
 /* Copied from xfce4-session/xfce4-session/xfsm-logout-dialog.c:
  * xfsm_logout_dialog () */
 void
@@ -542,14 +718,32 @@ logout_dialog_show (void)
 
 	gtk_widget_realize (dialog);
 
+	logout_census_phase ("dialog-constructed");
+
 	gdk_window_set_override_redirect (gtk_widget_get_window (dialog), TRUE);
 	gdk_window_raise (gtk_widget_get_window (dialog));
 	gtk_widget_destroy (hidden);
 
+#ifdef ENABLE_CENSUS
+	if (logout_census_autoclose () > 0)
+		census_autoclose_id = g_timeout_add (logout_census_autoclose (), on_census_autoclose, dialog);
+#endif
+
 	result = logout_dialog_run (dialog, TRUE);
 
+	logout_census_phase ("dialog-run");
+
+#ifdef ENABLE_CENSUS
+	if (census_autoclose_id > 0) {
+		g_source_remove (census_autoclose_id);
+		census_autoclose_id = 0;
+	}
+#endif
+
 	fadeout_window_hide (xwindows, gdk_screen_get_display (screen));
 	g_list_free (xwindows);
 
 	gtk_widget_destroy (dialog);
+
+	logout_census_phase ("dialog-destroyed");
 }
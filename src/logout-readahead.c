@@ -0,0 +1,220 @@
+/* 
+ * Copyright (C) 2018-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* The manifest is a text file with one "<offset> <length> <path>" line
+ * per range of a file whose pages gooroom-logout had faulted in. */
+
+#include "logout-readahead.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <glib/gstdio.h>
+
+#define IOPRIO_CLASS_SHIFT   13
+#define IOPRIO_CLASS_IDLE    3
+#define IOPRIO_WHO_PROCESS   1
+
+
+gchar *
+logout_readahead_manifest_path (void)
+{
+	return g_build_filename (g_get_user_cache_dir (), "gooroom-logout", "readahead", NULL);
+}
+
+/* Recorded once by an administrator and shipped with the image, used
+ * for accounts that have not recorded their own manifest yet */
+gchar *
+logout_readahead_system_manifest_path (void)
+{
+	return g_build_filename (LOCALSTATEDIR, "lib", "gooroom-logout", "readahead", NULL);
+}
+
+/* A page is recorded when it is present in this process' page tables,
+ * i.e. it was faulted in (or mapped along by the kernel's fault-around)
+ * during this run. Bit 63 of each 64-bit /proc/self/pagemap entry is the
+ * present bit; it stays readable without privileges, only the frame
+ * numbers are hidden. Whether the pages were in the page cache before
+ * does not matter. */
+#define PAGEMAP_PRESENT       (G_GUINT64_CONSTANT (1) << 63)
+#define PAGEMAP_CHUNK         512
+
+static void
+mapping_record (GString     *manifest,
+                gint         pagemap,
+                const gchar *path,
+                guintptr     start,
+                guintptr     end,
+                guint64      offset)
+{
+	gsize    page_size = sysconf (_SC_PAGESIZE);
+	gsize    n_pages, i, first = 0;
+	guint64  entries[PAGEMAP_CHUNK];
+	gsize    n_entries = 0, chunk_start = 0;
+	gboolean in_range = FALSE;
+
+	n_pages = (end - start) / page_size;
+
+	for (i = 0; i <= n_pages; i++) {
+		gboolean present = FALSE;
+
+		if (i < n_pages && i >= chunk_start + n_entries) {
+			gssize len;
+
+			chunk_start = i;
+			len = pread (pagemap, entries,
+                         MIN (n_pages - i, PAGEMAP_CHUNK) * sizeof (guint64),
+                         (start / page_size + i) * sizeof (guint64));
+
+			/* stop here, but still write out the current range */
+			if (len < (gssize) sizeof (guint64))
+				n_pages = i;
+			else
+				n_entries = len / sizeof (guint64);
+		}
+
+		if (i < n_pages)
+			present = (entries[i - chunk_start] & PAGEMAP_PRESENT) != 0;
+
+		if (present && !in_range) {
+			first = i;
+			in_range = TRUE;
+		} else if (!present && in_range) {
+			g_string_append_printf (manifest, "%" G_GUINT64_FORMAT " %" G_GSIZE_FORMAT " %s\n",
+                                    offset + first * page_size,
+                                    (i - first) * page_size,
+                                    path);
+			in_range = FALSE;
+		}
+	}
+}
+
+gboolean
+logout_readahead_record (const gchar *manifest, GError **error)
+{
+	gint      i, pagemap;
+	gchar    *maps, *dirname;
+	gchar   **lines;
+	GString  *output;
+	gboolean  ret;
+
+	if (!g_file_get_contents ("/proc/self/maps", &maps, NULL, error))
+		return FALSE;
+
+	pagemap = open ("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+	if (pagemap < 0) {
+		g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                     "Failed to open /proc/self/pagemap: %s", g_strerror (errno));
+		g_free (maps);
+		return FALSE;
+	}
+
+	output = g_string_new (NULL);
+	lines = g_strsplit (maps, "\n", -1);
+
+	for (i = 0; lines[i]; i++) {
+		guintptr      start, end;
+		guint64       offset, inode;
+		gint          path_start = 0;
+		char          perms[5];
+
+		if (sscanf (lines[i], "%" G_GINTPTR_MODIFIER "x-%" G_GINTPTR_MODIFIER "x %4s %" G_GINT64_MODIFIER "x %*s %" G_GINT64_MODIFIER "u %n",
+                    &start, &end, perms, &offset, &inode, &path_start) < 5)
+			continue;
+
+		/* only regular files, not anonymous memory or [heap] and friends */
+		if (inode == 0 || path_start == 0 || lines[i][path_start] != '/')
+			continue;
+
+		/* files replaced on disk since they were mapped */
+		if (g_str_has_suffix (lines[i], " (deleted)"))
+			continue;
+
+		mapping_record (output, pagemap, lines[i] + path_start, start, end, offset);
+	}
+
+	close (pagemap);
+	g_strfreev (lines);
+	g_free (maps);
+
+	dirname = g_path_get_dirname (manifest);
+	/* the system manifest is read by every user */
+	g_mkdir_with_parents (dirname, g_str_has_prefix (manifest, g_get_user_cache_dir ()) ? 0700 : 0755);
+	g_free (dirname);
+
+	ret = g_file_set_contents (manifest, output->str, output->len, error);
+	g_string_free (output, TRUE);
+
+	return ret;
+}
+
+/* Ask the kernel to start reading every range of @manifest into the page
+ * cache, at idle I/O priority so that the rest of the login is not
+ * slowed down. posix_fadvise() does not wait for the reads. */
+gboolean
+logout_readahead_replay (const gchar *manifest, GError **error)
+{
+	gint    i, fd = -1;
+	gchar  *contents, *current = NULL;
+	gchar **lines;
+
+	if (!g_file_get_contents (manifest, &contents, NULL, error))
+		return FALSE;
+
+	syscall (SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+             IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+
+	lines = g_strsplit (contents, "\n", -1);
+
+	for (i = 0; lines[i]; i++) {
+		guint64  offset, length;
+		gint     path_start = 0;
+		gchar   *path;
+
+		if (sscanf (lines[i], "%" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %n",
+                    &offset, &length, &path_start) < 2 || path_start == 0)
+			continue;
+
+		path = lines[i] + path_start;
+
+		/* ranges of the same file are written one after another */
+		if (g_strcmp0 (current, path) != 0) {
+			if (fd >= 0)
+				close (fd);
+			/* a path that has become a FIFO must not block the login */
+			fd = open (path, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+			current = path;
+		}
+
+		if (fd >= 0)
+			posix_fadvise (fd, offset, length, POSIX_FADV_WILLNEED);
+	}
+
+	if (fd >= 0)
+		close (fd);
+
+	g_strfreev (lines);
+	g_free (contents);
+
+	return TRUE;
+}
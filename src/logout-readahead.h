@@ -0,0 +1,38 @@
+/* 
+ * Copyright (C) 2018-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __LOGOUT_READAHEAD_H__
+#define __LOGOUT_READAHEAD_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+gchar        *logout_readahead_manifest_path        (void);
+
+gchar        *logout_readahead_system_manifest_path (void);
+
+gboolean      logout_readahead_record        (const gchar  *manifest,
+                                              GError      **error);
+
+gboolean      logout_readahead_replay        (const gchar  *manifest,
+                                              GError      **error);
+
+G_END_DECLS
+
+#endif
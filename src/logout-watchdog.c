@@ -0,0 +1,164 @@
+/* 
+ * Copyright (C) 2018-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* Main loop stall detector, enabled with GOOROOM_LOGOUT_WATCHDOG=<ms>
+ * (16 ms when empty or invalid).
+ *
+ * The poll function of the default main context notes when the main
+ * thread leaves poll() and reports iterations that took longer than the
+ * budget. A helper thread checks the same timestamp and, while the main
+ * thread is still busy past the budget, signals it so that the offending
+ * source and its backtrace are printed from the stalled stack itself. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "logout-watchdog.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_EXECINFO_H
+#include <execinfo.h>
+#endif
+
+#define STALL_SIGNAL SIGUSR2
+
+static gint64    budget          = 0;
+static gint64    iteration_start = 0;
+static guint     iteration       = 0;
+static pthread_t main_thread;
+static GPollFunc default_poll    = NULL;
+
+
+static void
+stall_write (const char *string)
+{
+	ssize_t ret;
+
+	ret = write (STDERR_FILENO, string, strlen (string));
+	(void) ret;
+}
+
+/* runs on the stalled main thread, only async-signal-safe calls apart
+ * from peeking at the current source */
+static void
+on_stall_signal (int signum)
+{
+	GSource     *source;
+	const gchar *name = NULL;
+
+	source = g_main_current_source ();
+	if (source)
+		name = g_source_get_name (source);
+
+	stall_write ("watchdog: main loop stalled in source ");
+	stall_write (name ? name : "(unnamed)");
+	stall_write ("\n");
+
+#ifdef HAVE_EXECINFO_H
+	void *frames[64];
+	int   n_frames;
+
+	n_frames = backtrace (frames, G_N_ELEMENTS (frames));
+	backtrace_symbols_fd (frames, n_frames, STDERR_FILENO);
+#endif
+}
+
+static gint
+watchdog_poll (GPollFD *ufds, guint nfds, gint timeout)
+{
+	gint   ret;
+	gint64 start, now;
+
+	start = __atomic_load_n (&iteration_start, __ATOMIC_RELAXED);
+	now = g_get_monotonic_time ();
+
+	if (start > 0 && now - start > budget)
+		g_printerr ("watchdog: main loop iteration took %" G_GINT64_FORMAT " ms\n",
+                    (now - start) / 1000);
+
+	__atomic_store_n (&iteration_start, 0, __ATOMIC_RELAXED);
+
+	ret = default_poll (ufds, nfds, timeout);
+
+	__atomic_add_fetch (&iteration, 1, __ATOMIC_RELAXED);
+	__atomic_store_n (&iteration_start, g_get_monotonic_time (), __ATOMIC_RELAXED);
+
+	return ret;
+}
+
+static gpointer
+watchdog_thread (gpointer data)
+{
+	guint  current, reported = 0;
+	gint64 start;
+
+	for (;;) {
+		g_usleep (budget / 2);
+
+		start = __atomic_load_n (&iteration_start, __ATOMIC_RELAXED);
+		current = __atomic_load_n (&iteration, __ATOMIC_RELAXED);
+
+		/* report each stalled iteration once */
+		if (start > 0 && current != reported &&
+            g_get_monotonic_time () - start > budget) {
+			reported = current;
+			pthread_kill (main_thread, STALL_SIGNAL);
+		}
+	}
+
+	return NULL;
+}
+
+void
+logout_watchdog_start (void)
+{
+	const gchar      *value;
+	struct sigaction  action;
+
+	value = g_getenv ("GOOROOM_LOGOUT_WATCHDOG");
+	if (value == NULL)
+		return;
+
+	budget = atoi (value) * G_TIME_SPAN_MILLISECOND;
+	if (budget <= 0)
+		budget = 16 * G_TIME_SPAN_MILLISECOND;
+
+#ifdef HAVE_EXECINFO_H
+	/* backtrace() may load libgcc on first use, not in a signal handler */
+	void *frame;
+	backtrace (&frame, 1);
+#endif
+
+	memset (&action, 0, sizeof (action));
+	action.sa_handler = on_stall_signal;
+	action.sa_flags = SA_RESTART;
+	sigemptyset (&action.sa_mask);
+	sigaction (STALL_SIGNAL, &action, NULL);
+
+	main_thread = pthread_self ();
+
+	default_poll = g_main_context_get_poll_func (NULL);
+	g_main_context_set_poll_func (NULL, watchdog_poll);
+
+	g_thread_unref (g_thread_new ("watchdog", watchdog_thread, NULL));
+}
@@ -23,8 +23,26 @@
 #include <gtk/gtk.h>
 #include <glib/gi18n.h>
 
+#include "logout-census.h"
 #include "logout-dialog.h"
+#include "logout-watchdog.h"
+#ifdef ENABLE_READAHEAD
+#include "logout-readahead.h"
+#endif
+
+#ifdef ENABLE_READAHEAD
+static gboolean opt_record_readahead = FALSE;
+static gboolean opt_record_system_readahead = FALSE;
+#endif
 
+static GOptionEntry options[] =
+{
+#ifdef ENABLE_READAHEAD
+	{ "record-readahead", 0, 0, G_OPTION_ARG_NONE, &opt_record_readahead, NULL, NULL },
+	{ "record-system-readahead", 0, 0, G_OPTION_ARG_NONE, &opt_record_system_readahead, NULL, NULL },
+#endif
+	{NULL}
+};
 
 static gboolean
 on_logout_dialog_show_idle (gpointer data)
@@ -40,6 +58,10 @@ int
 main (int argc, char **argv)
 {
 	GtkCssProvider *provider;
+	GError         *error = NULL;
+	guint           source_id;
+
+	logout_census_init (argc, argv);
 
 	/* Initialize i18n */
 	setlocale (LC_ALL, "");
@@ -47,7 +69,11 @@ main (int argc, char **argv)
 	bind_textdomain_codeset (GETTEXT_PACKAGE, "UTF-8");
 	textdomain (GETTEXT_PACKAGE);
 
-	gtk_init (&argc, &argv);
+	if (!gtk_init_with_args (&argc, &argv, NULL, options, GETTEXT_PACKAGE, &error)) {
+		g_warning ("Unable to start: %s", error ? error->message : "cannot open display");
+		g_clear_error (&error);
+		return 1;
+	}
 
 	provider = gtk_css_provider_new ();
 	gtk_css_provider_load_from_resource (provider, "/kr/gooroom/logout/theme.css");
@@ -56,9 +82,31 @@ main (int argc, char **argv)
 			GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
 	g_object_unref (provider);
 
-	g_timeout_add (10, (GSourceFunc)on_logout_dialog_show_idle, NULL);
+	logout_census_phase ("startup");
+
+	logout_watchdog_start ();
+
+	source_id = g_timeout_add (10, (GSourceFunc)on_logout_dialog_show_idle, NULL);
+	g_source_set_name_by_id (source_id, "[gooroom-logout] logout_dialog_show");
 
 	gtk_main ();
 
+	logout_census_report ();
+
+#ifdef ENABLE_READAHEAD
+	/* pages this run faulted in, replayed by gooroom-logout-readahead */
+	if (opt_record_readahead || opt_record_system_readahead) {
+		gchar *manifest = opt_record_system_readahead
+			? logout_readahead_system_manifest_path ()
+			: logout_readahead_manifest_path ();
+
+		if (!logout_readahead_record (manifest, &error)) {
+			g_warning ("Failed to record readahead manifest: %s", error->message);
+			g_clear_error (&error);
+		}
+		g_free (manifest);
+	}
+#endif
+
 	return 0;
 }
@@ -0,0 +1,76 @@
+#!/bin/sh
+# Take a census of one dialog run and compare the instances left alive at
+# exit with census.baseline: a type with more instances than recorded
+# fails the test. Allocation counts per phase depend on the host's GTK,
+# fontconfig and themes, they are printed but not checked.
+#
+# "make census-baseline" runs this with --update to record a new baseline
+# after an intended change.
+
+if [ "$ENABLE_CENSUS" != "yes" ]; then
+	echo "SKIP: configured without --enable-census"
+	exit 77
+fi
+
+. "$srcdir/test-lib.sh"
+
+baseline="$srcdir/census.baseline"
+
+# same policy, theme and settings on every host
+mkdir -p "$test_dir/config" "$test_dir/data" "$test_dir/cache"
+GOOROOM_LOGOUT_CONFIG=/dev/null
+XDG_CONFIG_HOME=$test_dir/config
+XDG_CONFIG_DIRS=$test_dir/config
+XDG_DATA_HOME=$test_dir/data
+XDG_CACHE_HOME=$test_dir/cache
+GSETTINGS_BACKEND=memory
+GTK_THEME=Adwaita
+GDK_SCALE=1
+LC_ALL=C
+export GOOROOM_LOGOUT_CONFIG XDG_CONFIG_HOME XDG_CONFIG_DIRS XDG_DATA_HOME \
+	XDG_CACHE_HOME GSETTINGS_BACKEND GTK_THEME GDK_SCALE LC_ALL
+
+start_bus
+start_stub 0
+
+GOOROOM_LOGOUT_CENSUS=1 GOOROOM_LOGOUT_CENSUS_AUTOCLOSE=1000 \
+	"$top_builddir/src/gooroom-logout" 2> "$test_dir/census.log" || exit 99
+
+if ! grep -q '^census: instances alive at exit' "$test_dir/census.log"; then
+	cat "$test_dir/census.log"
+	echo "FAIL: no census was printed"
+	exit 1
+fi
+
+grep '^census: ' "$test_dir/census.log" | grep -v '^census:   '
+
+# "leak <type> <instances>" lines
+awk '$1 == "census:" && $2 ~ /:$/ { print "leak", substr ($2, 1, length ($2) - 1), $3 }' \
+	"$test_dir/census.log" > "$test_dir/census.current"
+
+if [ "$1" = "--update" ]; then
+	{
+		sed -n '/^#/p' "$baseline"
+		cat "$test_dir/census.current"
+	} > "$test_dir/census.baseline"
+	mv "$test_dir/census.baseline" "$baseline"
+	echo "Updated $baseline"
+	exit 0
+fi
+
+if ! grep -q '^leak ' "$baseline"; then
+	cat "$test_dir/census.current"
+	echo "FAIL: $baseline has no entries, record it with \"make -C tests census-baseline\""
+	exit 1
+fi
+
+awk '
+	FNR == NR && /^leak / { base[$2] = $3; next }
+	/^leak / {
+		known = ($2 in base) ? base[$2] : 0
+		if ($3 > known) {
+			printf "FAIL: %d %s alive at exit, baseline %d\n", $3, $2, known
+			failed = 1
+		}
+	}
+	END { exit failed }' "$baseline" "$test_dir/census.current"
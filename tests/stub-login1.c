@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2018-2019 Gooroom <gooroom@gooroom.kr>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* Stand-in for org.freedesktop.login1 on the private bus of the tests.
+ * Every Can* method answers "yes", after STUB_LOGIN1_DELAY milliseconds
+ * when that is set. Prints "ready" once the name is owned. */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+static const gchar introspection_xml[] =
+	"<node>"
+	"  <interface name='org.freedesktop.login1.Manager'>"
+	"    <method name='CanPowerOff'><arg type='s' direction='out'/></method>"
+	"    <method name='CanReboot'><arg type='s' direction='out'/></method>"
+	"    <method name='CanSuspend'><arg type='s' direction='out'/></method>"
+	"    <method name='CanHibernate'><arg type='s' direction='out'/></method>"
+	"    <method name='CanHybridSleep'><arg type='s' direction='out'/></method>"
+	"    <method name='CanSuspendThenHibernate'><arg type='s' direction='out'/></method>"
+	"  </interface>"
+	"</node>";
+
+static guint delay = 0;
+
+
+static gboolean
+on_reply_timeout (gpointer user_data)
+{
+	GDBusMethodInvocation *invocation = G_DBUS_METHOD_INVOCATION (user_data);
+
+	g_dbus_method_invocation_return_value (invocation, g_variant_new ("(s)", "yes"));
+
+	return FALSE;
+}
+
+static void
+handle_method_call (GDBusConnection       *connection,
+                    const gchar           *sender,
+                    const gchar           *object_path,
+                    const gchar           *interface_name,
+                    const gchar           *method_name,
+                    GVariant              *parameters,
+                    GDBusMethodInvocation *invocation,
+                    gpointer               user_data)
+{
+	if (delay > 0)
+		g_timeout_add (delay, on_reply_timeout, invocation);
+	else
+		on_reply_timeout (invocation);
+}
+
+static const GDBusInterfaceVTable interface_vtable = {
+	handle_method_call,
+	NULL,
+	NULL
+};
+
+static void
+on_bus_acquired (GDBusConnection *connection,
+                 const gchar     *name,
+                 gpointer         user_data)
+{
+	GDBusNodeInfo *info = (GDBusNodeInfo *)user_data;
+
+	g_dbus_connection_register_object (connection,
+                                       "/org/freedesktop/login1",
+                                       info->interfaces[0],
+                                       &interface_vtable,
+                                       NULL, NULL, NULL);
+}
+
+static void
+on_name_acquired (GDBusConnection *connection,
+                  const gchar     *name,
+                  gpointer         user_data)
+{
+	g_print ("ready\n");
+	fflush (stdout);
+}
+
+static void
+on_name_lost (GDBusConnection *connection,
+              const gchar     *name,
+              gpointer         user_data)
+{
+	g_printerr ("Failed to own %s\n", name);
+	exit (1);
+}
+
+int
+main (int argc, char **argv)
+{
+	const gchar   *value;
+	GMainLoop     *loop;
+	GDBusNodeInfo *info;
+
+	value = g_getenv ("STUB_LOGIN1_DELAY");
+	if (value)
+		delay = atoi (value);
+
+	info = g_dbus_node_info_new_for_xml (introspection_xml, NULL);
+
+	g_bus_own_name (G_BUS_TYPE_SYSTEM,
+                    "org.freedesktop.login1",
+                    G_BUS_NAME_OWNER_FLAGS_NONE,
+                    on_bus_acquired,
+                    on_name_acquired,
+                    on_name_lost,
+                    info, NULL);
+
+	loop = g_main_loop_new (NULL, FALSE);
+	g_main_loop_run (loop);
+
+	return 0;
+}
@@ -0,0 +1,52 @@
+# Shared setup of the tests: a display, a private bus standing in for the
+# system bus, and the login1 stub on it.
+
+# gooroom-logout needs an X display, use a virtual one when there is none
+if [ -z "$DISPLAY" ]; then
+	if ! command -v xvfb-run > /dev/null; then
+		echo "SKIP: no X display and no xvfb-run"
+		exit 77
+	fi
+	exec xvfb-run -a /bin/sh "$0" "$@"
+fi
+
+if ! command -v dbus-daemon > /dev/null; then
+	echo "SKIP: no dbus-daemon"
+	exit 77
+fi
+
+test_dir=$(mktemp -d)
+stub_pid=
+bus_pid=
+
+cleanup () {
+	[ -n "$stub_pid" ] && kill "$stub_pid" 2> /dev/null
+	[ -n "$bus_pid" ] && kill "$bus_pid" 2> /dev/null
+	rm -rf "$test_dir"
+}
+trap cleanup EXIT
+
+# start_bus: private bus used as both system and session bus, so that
+# nothing of the real sessions leaks into the results
+start_bus () {
+	bus_info=$(dbus-daemon --session --fork --print-address=1 --print-pid=1) || exit 99
+	DBUS_SYSTEM_BUS_ADDRESS=$(echo "$bus_info" | sed -n 1p)
+	DBUS_SESSION_BUS_ADDRESS=$DBUS_SYSTEM_BUS_ADDRESS
+	bus_pid=$(echo "$bus_info" | sed -n 2p)
+	NO_AT_BRIDGE=1
+	export DBUS_SYSTEM_BUS_ADDRESS DBUS_SESSION_BUS_ADDRESS NO_AT_BRIDGE
+}
+
+# start_stub DELAY: login1 stub answering Can* after DELAY milliseconds
+start_stub () {
+	STUB_LOGIN1_DELAY=$1 "$top_builddir/tests/stub-login1" > "$test_dir/stub.log" &
+	stub_pid=$!
+
+	for i in $(seq 50); do
+		grep -q ready "$test_dir/stub.log" && return 0
+		sleep 0.1
+	done
+
+	echo "login1 stub did not start"
+	exit 99
+}
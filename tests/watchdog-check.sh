@@ -0,0 +1,27 @@
+#!/bin/sh
+# Delay every login1 Can* reply and check that the watchdog reports the
+# dialog construction, which makes those calls on the main loop, as stalled.
+
+. "$srcdir/test-lib.sh"
+
+start_bus
+start_stub 200
+
+GOOROOM_LOGOUT_WATCHDOG=16 "$top_builddir/src/gooroom-logout" 2> "$test_dir/watchdog.log" &
+logout_pid=$!
+
+# the dialog stays up, stop it once the report is out or after 10 seconds
+for i in $(seq 100); do
+	grep -q 'watchdog: main loop stalled in source' "$test_dir/watchdog.log" && break
+	kill -0 "$logout_pid" 2> /dev/null || break
+	sleep 0.1
+done
+kill "$logout_pid" 2> /dev/null
+wait "$logout_pid" 2> /dev/null
+
+cat "$test_dir/watchdog.log"
+
+if ! grep -q 'watchdog: main loop stalled in source \[gooroom-logout\] logout_dialog_show' "$test_dir/watchdog.log"; then
+	echo "FAIL: no stall was reported for the dialog construction"
+	exit 1
+fi